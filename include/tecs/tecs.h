@@ -2,9 +2,39 @@
 #define _TECS_H_
 
 #include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
 #include <assert.h>
 #include <cassert>
+#include <cstdio>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TECS_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #ifndef SKIP_DEFINE_OSTREAM_SERIALIZATION
 #include <ostream>
@@ -22,6 +52,40 @@ typedef unsigned long u32;
 #define TECS_ASSERT(expression, message) ((void)0);
 #endif
 
+// Assert for code running on many threads, TECS_ASSERT is only reached on
+// failure as it may not be thread safe
+#define TECS_ASSERT_CONCURRENT(expression, message) \
+    do {                                            \
+        if (!(expression)) {                        \
+            TECS_ASSERT(expression, message);       \
+        }                                           \
+    } while (0)
+
+// Records the component accesses of scheduled systems to report conflicts,
+// @see SystemScheduler. Off by default. It changes the layout of the
+// scheduler, so define it the same way in every translation unit.
+#ifndef TECS_ACCESS_CHECKS
+#define TECS_ACCESS_CHECKS 0
+#endif
+
+#if TECS_ACCESS_CHECKS
+#define TECS_RECORD_ACCESS(type) tecs::recordAccess(type)
+#else
+// Unevaluated, but keeps parameter packs in the expression
+#define TECS_RECORD_ACCESS(type) ((void)sizeof(type))
+#endif
+
+// Prefetch hint used by pipelined iteration, define it to override
+#ifndef TECS_PREFETCH
+#if defined(__GNUC__) || defined(__clang__)
+#define TECS_PREFETCH(address) __builtin_prefetch(address)
+#elif defined(_MSC_VER)
+#define TECS_PREFETCH(address) _mm_prefetch((const char*)(address), _MM_HINT_T0)
+#else
+#define TECS_PREFETCH(address) ((void)0)
+#endif
+#endif
+
 #ifndef TECS_CHECK
 #define TECS_CHECK(expression, message) \
     if (expression) {                   \
@@ -51,8 +115,21 @@ struct AlwaysFalse : std::false_type {
         return id;                                             \
     }
 
+// Describes a component field for columnar export, @see Ecs::exportColumns()
+#define TECS_FIELD(CompClass, field) \
+    tecs::FieldDescriptor{#field, offsetof(CompClass, field), sizeof(CompClass::field)}
+
 namespace tecs {
 
+/**
+* Position of an arena allocation, relative to the arena base.
+* The Ecs refers to arena memory only through offsets, so the used part of
+* the arena can be copied or mapped at another address and keeps working.
+* 0 is used as null: the first allocation of an arena is the Ecs entities
+* array, which is never looked up through a nullable offset.
+*/
+typedef std::uint32_t ArenaOffset;
+
 /**
 * Arena allocator used by ECS
 * The ECS does not cat about freeing memory.
@@ -63,11 +140,14 @@ namespace tecs {
 * Allocation of outbound memory will assert.
 */
 struct ArenaAllocator {
-    ArenaAllocator() : base{0}, total{0}, current{0}
+    ArenaAllocator() : base{0}, total{0}, used{0}
     {
     }
     ArenaAllocator(char* memory, u32 size)
-        : base{memory}, total{size}, current{base} {};
+        : base{memory}, total{size}, used{0}
+    {
+        TECS_ASSERT(size <= UINT32_MAX, "Arena must be addressable by ArenaOffset!");
+    };
 
     /**
     * Allocs a chunk of memory from the arena.
@@ -77,30 +157,104 @@ struct ArenaAllocator {
     template <typename T>
     T* alloc(u32 n)
     {
-        const u32 size = sizeof(T) * n;
-        TECS_ASSERT(current + size < base + total, "Arena overflow!");
-        void* ptr = current;
-        current += size;
-        return (T*)ptr;
+        return at<T>(allocOffset<T>(n));
+    }
+
+    /**
+    * Allocs a chunk of memory from the arena.
+    * Allocations are aligned to at least 8 bytes from the arena base, so
+    * words in them can be updated atomically.
+    * Throws when the arena is full.
+    *
+    * @return the offset of the allocation, @see at()
+    */
+    template <typename T>
+    ArenaOffset allocOffset(u32 n)
+    {
+        constexpr std::uint64_t alignment = alignof(T) > 8 ? alignof(T) : 8;
+        const std::uint64_t offset = (std::uint64_t(used) + alignment - 1) & ~(alignment - 1);
+        const std::uint64_t end = offset + std::uint64_t(sizeof(T)) * n;
+        if (end > total) {
+            TECS_LOG_ERROR("Arena overflow!");
+            throw("Arena overflow");
+        }
+        used = ArenaOffset(end);
+        return ArenaOffset(offset);
+    }
+
+    /**
+    * Address of an allocation from its offset
+    */
+    template <typename T>
+    T* at(ArenaOffset offset) const
+    {
+        return (T*)(base + offset);
+    }
+
+    /**
+    * Position of the next allocation.
+    * Everything allocated after it can be given back with rewind(), useful
+    * for temporary buffers.
+    */
+    ArenaOffset mark() const
+    {
+        return used;
+    }
+
+    void rewind(ArenaOffset mark)
+    {
+        used = mark;
+    }
+
+    char* memory() const
+    {
+        return base;
+    }
+
+    u32 size() const
+    {
+        return total;
+    }
+
+    /**
+    * Amount of bytes allocated, always from the beginning of the memory.
+    */
+    u32 usedSize() const
+    {
+        return used;
+    }
+
+    /**
+    * Moves the arena to another memory, which must already contain a copy
+    * of the used bytes.
+    */
+    void rebase(char* memory, u32 size)
+    {
+        TECS_ASSERT(used <= size, "Arena does not fit in the new memory!");
+        base = memory;
+        total = size;
     }
 
 private:
     char* base;
     u32 total;
-    char* current;
+    ArenaOffset used;
 };
 
 typedef u32 ComponentHandle;
 
+// The generation is wide enough not to wrap in practice, so a stale
+// handle does not become valid again after its id is reused many times,
+// e.g. by unloading a region over and over
 struct EntityHandleParts {
-    u32 alive : 1;
-    u32 generation : 3;
-    u32 id : 28;
+    std::uint64_t alive : 1;
+    std::uint64_t generation : 31;
+    std::uint64_t id : 28;
 };
 
 bool operator<(const EntityHandleParts& a, const EntityHandleParts& b)
 {
-    return (*(u32*)&a) < (*(u32*)&b);
+    return (*(std::uint64_t*)&a) < (*(std::uint64_t*)&b);
 }
 
 #ifndef SKIP_DEFINE_OSTREAM_SERIALIZATION
@@ -120,688 +274,4666 @@ struct ChunkEmptyEntry {
 
 // TODO: Calculate this based on max entities and max component types
 static constexpr u32 MaxComponentChunks = 32;
+// Changed dense chunks of a container, one bit per chunk
+typedef u32 ChunkMask;
+static constexpr ChunkMask AllChunks = 0xffffffff;
+static_assert(MaxComponentChunks <= 32, "Chunk masks must fit all chunks!");
 
-struct ComponentContainer {
-    u32 idChunkSize = 512;
-    u32 componentSize = 0;
-
-    char** denseData; // char, but actually contains component data
-    u32 chunkSize; // Amount of entries in each dense chunk
-    u32 aliveComponents = 0;
-    ChunkEmptyEntry freeComponentHandle = {0};
+typedef std::uint64_t BitsetWord;
+static constexpr u32 BitsPerWord = 64;
+// Amount of entity ids covered by a single summary bit (64 words of 64 bits)
+static constexpr u32 BitsetBlockEntities = BitsPerWord * BitsPerWord;
 
-    EntityHandle** denseEntities;
-    u32** sparseIds; // Indexes the component for each entity
-};
+inline u32 countTrailingZeros(BitsetWord word)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return index;
+#else
+    return __builtin_ctzll(word);
+#endif
+}
 
-/**
- *
- * @brief Entity Managing Class. Responsible for the creation and removal of
- * entities and components.
- * Requires a ArenaAllocator to perform memory allocations.
- * The Ecs will only use memory available in the ArenaAllocator for dynamic
- * allocations.
- * The memory in ArenaAllocator is never freed and always recycled.
- * Make sure to provide a big enough chunk of memory for your use case.
- *
- * @param TypeProvider A class that provides a static TypeId<T>() call to fetch
- * component type id.
- * component types must be sequential and begin from 1
- * @param MaxComponents_ Limit the amount of component types accepted.
- * Doesn't need to be an exact number, but must be AT LEAST the total types that
- * will be ever used. Base component container chunks are stored in the class
- * stack.
- *
-**/
-template <typename TypeProvider, unsigned char MaxComponents_>
-class Ecs {
-protected:
-    struct TEntity {
-        EntityHandle handle;
-        // Maybe store something else?
-    };
+// Atomic operations on plain integers, so structures using them stay
+// trivially copyable. T must be 4 or 8 bytes.
+#if defined(_MSC_VER)
+template <typename T>
+inline bool atomicCompareExchange(T* value, T& expected, T desired)
+{
+    T previous;
+    if constexpr (sizeof(T) == 8) {
+        previous = (T)_InterlockedCompareExchange64((volatile __int64*)value, (__int64)desired,
+                                                    (__int64)expected);
+    }
+    else {
+        previous = (T)_InterlockedCompareExchange((volatile long*)value, (long)desired,
+                                                  (long)expected);
+    }
+    const bool exchanged = previous == expected;
+    expected = previous;
+    return exchanged;
+}
 
-public:
-    static constexpr auto MaxComponents = MaxComponents_;
-    using Entity = TEntity;
+template <typename T>
+inline T atomicFetchAdd(T* value, T amount)
+{
+    if constexpr (sizeof(T) == 8) {
+        return (T)_InterlockedExchangeAdd64((volatile __int64*)value, (__int64)amount);
+    }
+    else {
+        return (T)_InterlockedExchangeAdd((volatile long*)value, (long)amount);
+    }
+}
 
-    /**
-    * @brief Default constructor provided for convinience.
-    * Should be initialized by calling @see init()
-    */
-    Ecs()
-    {
+template <typename T>
+inline T atomicFetchOr(T* value, T bits)
+{
+    if constexpr (sizeof(T) == 8) {
+        return (T)_InterlockedOr64((volatile __int64*)value, (__int64)bits);
+    }
+    else {
+        return (T)_InterlockedOr((volatile long*)value, (long)bits);
     }
+}
 
-    /**
-    * @brief Contructor with arena allocator and max entities.
-    * Max entities is required to allocate the space for containing
-    * these entities up-front.
-    * This avoids the need to check/create chunk for entities.
-    *
-    * @param arenaAllocator ArenaAllocator already initialized with memory
-    * @param maxEntities Maximum number of entities that the Ecs is expected to
-    * have
-    *
-    * TODO: Accept 0 as "unbounded" option.
-    */
-    Ecs(ArenaAllocator&& arenaAllocator, u32 maxEntities = 100'000)
-    {
-        init(std::move(arenaAllocator), maxEntities);
+template <typename T>
+inline T atomicLoad(const T* value)
+{
+    T expected = 0;
+    atomicCompareExchange((T*)value, expected, T(0));
+    return expected;
+}
+
+template <typename T>
+inline void atomicStore(T* value, T desired)
+{
+    T expected = atomicLoad(value);
+    while (!atomicCompareExchange(value, expected, desired)) {
     }
+}
+#else
+template <typename T>
+inline bool atomicCompareExchange(T* value, T& expected, T desired)
+{
+    return __atomic_compare_exchange_n(value, &expected, desired, true, __ATOMIC_ACQ_REL,
+                                       __ATOMIC_ACQUIRE);
+}
 
-    /**
-    * @brief initializes the Ecs structure.
-    *
-    * @param arenaAllocator ArenaAllocator already initialized with memory
-    * @param maxEntities Maximum number of entities that the Ecs is expected to
-    * have
-    */
-    void init(ArenaAllocator&& arenaAllocator, u32 maxEntities)
+template <typename T>
+inline T atomicFetchAdd(T* value, T amount)
+{
+    return __atomic_fetch_add(value, amount, __ATOMIC_ACQ_REL);
+}
+
+template <typename T>
+inline T atomicFetchOr(T* value, T bits)
+{
+    return __atomic_fetch_or(value, bits, __ATOMIC_ACQ_REL);
+}
+
+template <typename T>
+inline T atomicLoad(const T* value)
+{
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+inline void atomicStore(T* value, T desired)
+{
+    __atomic_store_n(value, desired, __ATOMIC_RELEASE);
+}
+#endif
+
+/**
+ * Two level occupancy bitset over entity ids.
+ * entityWords has one bit per entity id, blockWords has one bit per word of
+ * entityWords, so a zero word in blockWords means a block of 4096 entities
+ * without the component.
+ * entityWords is always allocated in whole blocks (64 words).
+ */
+struct EntityBitset {
+    ArenaOffset entityWords;
+    ArenaOffset blockWords;
+    u32 blockWordCount; // Amount of words in blockWords, one per block
+    u32 occupiedBlocks; // Amount of non zero words in blockWords
+
+    void set(const ArenaAllocator& arena, u32 entity)
     {
-        this->maxEntities = maxEntities;
-        allocator = arenaAllocator;
-        entities = allocator.alloc<Entity>(maxEntities + 1); // 0 is reserved
-        liveEntities = 0;
-        containers = {};
-        nextFreeEntity = 0;
+        const u32 word = entity / BitsPerWord;
+        arena.at<BitsetWord>(entityWords)[word] |= BitsetWord(1) << (entity % BitsPerWord);
+        BitsetWord& block = arena.at<BitsetWord>(blockWords)[word / BitsPerWord];
+        occupiedBlocks += (block == 0);
+        block |= BitsetWord(1) << (word % BitsPerWord);
     }
 
     /**
-    * @brief Creates a new entity
-    *
-    * @return Returns a EntityHandle to be used for further operations @see
-    * addComponent(), removeEntity()
-    */
-    EntityHandle newEntity()
+     * @brief Same as set(), safe to call from many threads at once.
+     */
+    void setConcurrent(const ArenaAllocator& arena, u32 entity)
     {
-        u32 newId;
-        if (nextFreeEntity > 0) {
-            newId = nextFreeEntity;
-            ++liveEntities;
-            nextFreeEntity = ((ChunkEmptyEntry*)(&entities[nextFreeEntity]))->nextFree;
+        const u32 word = entity / BitsPerWord;
+        atomicFetchOr(arena.at<BitsetWord>(entityWords) + word,
+                      BitsetWord(1) << (entity % BitsPerWord));
+        BitsetWord* block = arena.at<BitsetWord>(blockWords) + word / BitsPerWord;
+        if (atomicFetchOr(block, BitsetWord(1) << (word % BitsPerWord)) == 0) {
+            atomicFetchAdd(&occupiedBlocks, u32(1));
         }
-        else {
-            ++liveEntities;
-            newId = liveEntities;
-            TECS_ASSERT(newId <= maxEntities, "Can't create more entities!");
-        }
-
-        Entity& e = entities[newId];
-        u32 id = newId;
-        // TODO: Consider a bitfield variable for checking component handles
-        // so we dont need to clean up the handles list
-        EntityHandle prevHandle = e.handle;
-        e = {};
-        e.handle = e.handle;
-        e.handle.id = id;
-        e.handle.alive = 1;
-        return e.handle;
     }
 
-    /**
-     * @brief removes an entity
-     * Does nothing if the entity does not exist.
-     * Associated components are also destroyed.
-     *
-     * @param handle The entity to be removed
-     */
-    void removeEntity(const EntityHandle entityHandle)
+    void clear(const ArenaAllocator& arena, u32 entity)
     {
-        if (isEntityHandleValid(entityHandle)) {
-            destroyExistingEntity(entityHandle);
+        const u32 word = entity / BitsPerWord;
+        BitsetWord& bits = arena.at<BitsetWord>(entityWords)[word];
+        bits &= ~(BitsetWord(1) << (entity % BitsPerWord));
+        if (bits == 0) {
+            BitsetWord& block = arena.at<BitsetWord>(blockWords)[word / BitsPerWord];
+            block &= ~(BitsetWord(1) << (word % BitsPerWord));
+            occupiedBlocks -= (block == 0);
         }
     }
 
     /**
-     * @brief removes an entity
-     * Assumes the entity is valid to be removed.
-     * Use only if known that the entity exists.
-     *
-     * @param handle The entity to be removed
+     * @brief Clears the bits of count entities, both multiples of
+     * BitsPerWord.
      */
-    void destroyExistingEntity(const EntityHandle entityHandle)
+    void clearRange(const ArenaAllocator& arena, u32 first, u32 count)
     {
-        Entity& e = entities[entityHandle.id];
-
-        // TODO: Consider ways to reduce amount of containers we need to iterate
-        // over
-        u32 index = 0;
-        for (ComponentContainer& container : containers) {
-            removeComponentOfExistingEntity(entityHandle, index);
-            ++index;
+        BitsetWord* words = arena.at<BitsetWord>(entityWords);
+        BitsetWord* blocks = arena.at<BitsetWord>(blockWords);
+        const u32 firstWord = first / BitsPerWord;
+        const u32 endWord = (first + count) / BitsPerWord;
+        std::memset(words + firstWord, 0, sizeof(BitsetWord) * (endWord - firstWord));
+        for (u32 word = firstWord; word < endWord; ++word) {
+            BitsetWord& block = blocks[word / BitsPerWord];
+            if (block != 0) {
+                block &= ~(BitsetWord(1) << (word % BitsPerWord));
+                occupiedBlocks -= (block == 0);
+            }
         }
-
-        e.handle.id = nextFreeEntity; // ((ChunkEmptyEntry *)(&e))->nextFree =
-                                      // nextFreeEntity;
-        e.handle.generation += 1;
-        e.handle.alive = 0;
-
-        u32 prevId = entityHandle.id;
-        nextFreeEntity = prevId;
-        --liveEntities;
     }
 
-    /**
-     * @brief Check if an entity handle is valid
-     *
-     * @param handle the entity handle
-     *
-     * @return true if the entity is alive and is from the same generation.
-     */
-    bool isEntityHandleValid(EntityHandle handle)
+    bool test(const ArenaAllocator& arena, u32 entity) const
     {
-        return isEntityAlive(handle) &&
-               entities[handle.id].handle.generation == handle.generation;
+        const BitsetWord* words = arena.at<BitsetWord>(entityWords);
+        return (words[entity / BitsPerWord] >> (entity % BitsPerWord)) & 1;
     }
 
     /**
-     * @brief Add a component to an entity. The entity must exist!
-     *
-     * @param <T> the componen type
-     * @param entityHandle the entity to add a component
+     * @brief Calls f(entity) for every set entity, in ascending order.
      */
-    template <typename T>
-    T& addComponent(EntityHandle entityHandle)
+    template <typename F>
+    void forEachEntity(const ArenaAllocator& arena, F f) const
     {
-        static_assert(sizeof(T) >= sizeof(ChunkEmptyEntry));
-        if (isEntityHandleValid(entityHandle)) {
-            u32 compTypeId = TypeProvider::template TypeId<T>();
-
-            ComponentContainer& c = ensureComponentContainer(compTypeId, sizeof(T));
-
-            const u32 sparseEntityIdx = entityHandle.id / c.idChunkSize;
-            const u32 denseEntityIdx = entityHandle.id % c.idChunkSize;
-            if (c.sparseIds[sparseEntityIdx] == nullptr) {
-                // This id was not in the set, so the entity does not have the
-                // component.
-
-                // Allocate sparse id chunk
-                c.sparseIds[sparseEntityIdx] = allocator.alloc<u32>(c.idChunkSize);
-
-                // Check if we can recycle any component handle
-                if (isComponentHandleValid(c.freeComponentHandle.nextFree)) {
-                    u32 componentHandle = c.freeComponentHandle.nextFree;
-                    forwardFreeIndex(c);
+        const BitsetWord* words = arena.at<BitsetWord>(entityWords);
+        const BitsetWord* blocks = arena.at<BitsetWord>(blockWords);
+        for (u32 block = 0; block < blockWordCount; ++block) {
+            BitsetWord summary = blocks[block];
+            while (summary != 0) {
+                const u32 word = block * BitsPerWord + countTrailingZeros(summary);
+                summary &= summary - 1;
 
-                    c.sparseIds[sparseEntityIdx][denseEntityIdx] = componentHandle;
-                    T* component = (T*)accessComponentData(c, componentHandle);
-                    pushDenseEntity(c, entityHandle);
-                    return *component;
-                }
-                else {
-                    // Add next available dense index as the new component
-                    u32 componentHandle = c.aliveComponents + 1;
-                    c.sparseIds[sparseEntityIdx][denseEntityIdx] = componentHandle;
-                    T* component = (T*)accessComponentData(c, componentHandle);
-                    pushDenseEntity(c, entityHandle);
-                    return *component;
+                BitsetWord bits = words[word];
+                while (bits != 0) {
+                    f(word * BitsPerWord + countTrailingZeros(bits));
+                    bits &= bits - 1;
                 }
             }
-            else {
-                u32 possibleHandle = c.sparseIds[sparseEntityIdx][denseEntityIdx];
-                if (isComponentHandleValid(possibleHandle)) {
-                    // Entity already contains the component
-                    return *(T*)accessComponentData(c, possibleHandle);
-                }
-                else {
-                    // Add next available dense index as the new component
-                    u32 componentHandle = c.aliveComponents + 1;
-                    c.sparseIds[sparseEntityIdx][denseEntityIdx] = componentHandle;
-                    T* component = (T*)accessComponentData(c, componentHandle);
-                    pushDenseEntity(c, entityHandle);
-                    return *component;
+        }
+    }
+};
+
+/**
+ * @brief ANDs the same block (64 words) of multiple bitsets together.
+ *
+ * @param bitsets the entity words of the bitsets to intersect
+ * @param count amount of bitsets
+ * @param firstWord index of the first entity word of the block
+ * @param out receives the 64 resulting words
+ */
+inline void intersectBitsetBlock(const BitsetWord* const* bitsets,
+                                 u32 count,
+                                 u32 firstWord,
+                                 BitsetWord* out)
+{
+    const BitsetWord* first = bitsets[0] + firstWord;
+#if defined(__AVX2__)
+    for (u32 w = 0; w < BitsPerWord; w += 4) {
+        __m256i acc = _mm256_loadu_si256((const __m256i*)(first + w));
+        for (u32 b = 1; b < count; ++b) {
+            const BitsetWord* words = bitsets[b] + firstWord;
+            acc = _mm256_and_si256(acc, _mm256_loadu_si256((const __m256i*)(words + w)));
+        }
+        _mm256_storeu_si256((__m256i*)(out + w), acc);
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    for (u32 w = 0; w < BitsPerWord; w += 2) {
+        __m128i acc = _mm_loadu_si128((const __m128i*)(first + w));
+        for (u32 b = 1; b < count; ++b) {
+            const BitsetWord* words = bitsets[b] + firstWord;
+            acc = _mm_and_si128(acc, _mm_loadu_si128((const __m128i*)(words + w)));
+        }
+        _mm_storeu_si128((__m128i*)(out + w), acc);
+    }
+#else
+    for (u32 w = 0; w < BitsPerWord; ++w) {
+        BitsetWord acc = first[w];
+        for (u32 b = 1; b < count; ++b) {
+            acc &= bitsets[b][firstWord + w];
+        }
+        out[w] = acc;
+    }
+#endif
+}
+
+/**
+ * Strategy used by forEach to join multiple component containers.
+ * Auto: Let the Ecs decide based on the container sizes.
+ * ProbeJoin: Walk the smallest container and probe the others sparse ids.
+ * PrefetchedProbeJoin: Same as ProbeJoin, but sparse ids and components are
+ * prefetched a few entities ahead of the callback to hide cache misses.
+ * BitsetIntersection: AND the containers occupancy bitsets, skipping empty
+ * blocks of 4096 entities, and only then resolve the components.
+ * MergeJoin: Walk all containers dense entities in lockstep. Requires every
+ * container to be sorted by entity, @see Ecs::sortByEntity()
+ */
+enum class QueryStrategy {
+    Auto,
+    ProbeJoin,
+    PrefetchedProbeJoin,
+    BitsetIntersection,
+    MergeJoin
+};
+
+/**
+ * Statistics of a component container, used to plan queries.
+ */
+struct ContainerStats {
+    u32 type;
+    u32 count; // Alive components
+    u32 slots; // Dense entries walked when driving a query, holes included
+    u32 occupiedBlocks; // Blocks of 4096 entities with at least one component
+    float density; // Fraction of entities with the component inside occupied blocks
+    bool sortedByEntity; // Dense entities are in ascending entity order
+};
+
+/**
+ * Result of planning a query over N component types.
+ * ProbeJoin walks drivingType and probes probeTypes in order, most selective
+ * first so entities are rejected as early as possible.
+ */
+template <u32 N>
+struct QueryPlan {
+    QueryStrategy strategy;
+    u32 drivingType;
+    u32 probeTypes[N]; // Only the first N - 1 are used
+    float expectedMatches;
+};
+
+struct ComponentContainer {
+    u32 idChunkSize = 512;
+    u32 componentSize = 0;
+
+    // All arrays are in the arena, @see ArenaOffset
+    ArenaOffset denseData; // Offsets of the dense chunks, containing component data
+    u32 chunkSize; // Amount of entries in each dense chunk
+    u32 aliveComponents = 0;
+    u32 highestHandle = 0; // Handles up to this one are either in use or free
+    ChunkEmptyEntry freeComponentHandle = {0};
+
+    // Stays true while components are appended with increasing entity ids
+    bool sortedByEntity = true;
+    u32 highestEntity = 0;
+
+    ChunkMask changedChunks = 0; // Dense data chunks possibly written, @see Ecs::takeChangedChunks()
+    ChunkMask regionChunks = 0; // Dense chunks owned by a region, @see Ecs::createRegion()
+    ChunkMask droppedChunks = 0; // Chunks of unloaded regions, without entries until reused
+
+    ArenaOffset denseEntities; // Offsets of chunks with the owner of each dense entry, id 0 if free
+    ArenaOffset sparseIds; // Offsets of pages indexing the component for each entity, 0 if none
+    EntityBitset entityBits; // Which entities have the component
+};
+
+/**
+ * Walks the dense storage of a container in handle order, moving between
+ * chunks with pointer increments instead of dividing every handle.
+ */
+struct DenseCursor {
+    ComponentContainer* container;
+    const ArenaAllocator* arena;
+    ComponentHandle position = 0;
+    ComponentHandle chunkEnd = 0; // First handle of the next chunk
+    EntityHandle* entity = nullptr;
+    char* data = nullptr;
+
+    /**
+     * @brief Must be placed with seek() before use.
+     */
+    DenseCursor(ComponentContainer* container, const ArenaAllocator* arena)
+        : container{container}, arena{arena}
+    {
+    }
+
+    void seek(ComponentHandle handle)
+    {
+        const u32 chunk = handle / container->chunkSize;
+        const u32 offset = handle % container->chunkSize;
+        position = handle;
+        chunkEnd = (chunk + 1) * container->chunkSize;
+        const ArenaOffset entityChunk = arena->at<ArenaOffset>(container->denseEntities)[chunk];
+        const ArenaOffset dataChunk = arena->at<ArenaOffset>(container->denseData)[chunk];
+        entity = arena->at<EntityHandle>(entityChunk) + offset;
+        data = arena->at<char>(dataChunk) + offset * container->componentSize;
+    }
+
+    /**
+     * @brief Advances to the next dense entry in use.
+     *
+     * @return false once the end of the container is reached
+     */
+    bool next()
+    {
+        do {
+            if (++position > container->highestHandle) {
+                return false;
+            }
+            if (position == chunkEnd) {
+                seek(position);
+            }
+            else {
+                ++entity;
+                data += container->componentSize;
+            }
+        } while (entity->id == 0);
+        return true;
+    }
+};
+
+/**
+ * Where a pass resumes, @see Ecs::forEachBudgeted()
+ */
+struct IterationCursor {
+    ComponentHandle position = 0; // Last dense entry visited, 0 to start a pass
+};
+
+/**
+ * How much of a pass runs per call, @see Ecs::forEachBudgeted()
+ */
+struct IterationBudget {
+    u32 entities = ~u32(0); // Matching entities to process
+    std::chrono::steady_clock::duration time = std::chrono::steady_clock::duration::max();
+};
+
+/**
+ * Template entity to instantiate in bulk, @see Ecs::definePrefab()
+ * Lives in the arena of the Ecs that defined it.
+ */
+struct Prefab {
+    ArenaOffset components = 0; // PrefabComponent array
+    u32 componentCount = 0;
+};
+
+struct PrefabComponent {
+    u32 type;
+    ArenaOffset data; // Default value of the component
+};
+
+/**
+ * Handle of a region of an Ecs, @see Ecs::createRegion()
+ * 0 stands for the rest of the world.
+ */
+typedef u32 RegionHandle;
+
+static constexpr u32 MaxRegions = 16;
+static_assert(MaxRegions < 256, "The region of an id page is stored in a byte!");
+
+/**
+ * Entities of a region take their ids from a reserved range, and their
+ * sparse pages and dense chunks from a reserved block of the arena.
+ */
+struct Region {
+    ArenaOffset memory = 0;
+    u32 size = 0;
+    u32 used = 0;
+    u32 firstEntity = 0;
+    u32 entityCapacity = 0; // Whole sparse pages
+    u32 entityCount = 0; // Ids handed out from firstEntity
+    u32 freeEntities = 0; // Destroyed ids, linked like the world ones
+    ArenaOffset containers = 0; // RegionContainer per component type
+};
+
+/**
+ * Dense chunks owned by a region in a component container
+ */
+struct RegionContainer {
+    ChunkMask chunks;
+    ComponentHandle next; // Next entry of the last chunk, 0 once full
+};
+
+static constexpr std::uint32_t SnapshotMagic = 0x53434554; // "TECS"
+static constexpr std::uint32_t SnapshotVersion = 2;
+
+/**
+ * First bytes of a snapshot file, @see Ecs::saveSnapshot()
+ * The Ecs object follows the header, and the used part of the arena starts
+ * at arenaOffset.
+ */
+struct SnapshotHeader {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t maxComponents;
+    std::uint32_t worldSize; // sizeof the saved Ecs
+    std::uint32_t arenaOffset; // File position of the arena
+    std::uint32_t arenaUsed; // Bytes of arena in the file
+    std::uint32_t arenaSize; // Arena size when saved, reserved again on load
+};
+
+/**
+ * First bytes of a delta between two states of a world, @see
+ * Ecs::encodeDelta()
+ * Followed by the new Ecs object, runCount runs and the arena tail.
+ */
+struct DeltaHeader {
+    std::uint32_t worldSize; // sizeof the encoded Ecs
+    std::uint32_t baselineUsed; // Arena bytes of the baseline
+    std::uint32_t arenaUsed; // Arena bytes of the new state
+    std::uint32_t runCount;
+};
+
+/**
+ * Changed words of the arena, XORed with the baseline.
+ * Followed by length words.
+ */
+struct DeltaRun {
+    std::uint32_t skip; // Unchanged words since the end of the previous run
+    std::uint32_t length;
+};
+
+enum class JournalOp : std::uint8_t {
+    NewEntity = 1,
+    DestroyEntity,
+    AddComponent,
+    RemoveComponent,
+    WriteComponent,
+    DisableEntity,
+    EnableEntity,
+    UnloadRegion, // entity is the first id of the region, type the region
+    RecordsLost // Records were dropped before this one, replay stops here
+};
+
+/**
+ * Structural change recorded in a journal, @see Ecs::enableJournal()
+ * WriteComponent records are followed by size bytes of component data.
+ */
+struct JournalRecord {
+    JournalOp op;
+    std::uint8_t type; // Component type id
+    std::uint16_t reserved; // Always 0
+    std::uint32_t entity; // Entity id
+    std::uint32_t size; // Component size
+};
+
+static constexpr std::uint32_t ColumnsMagic = 0x43434554; // "TECC"
+static constexpr std::uint32_t ColumnsVersion = 1;
+
+/**
+ * A field of a component, exported as its own column
+ */
+struct FieldDescriptor {
+    const char* name;
+    std::uint32_t offset;
+    std::uint32_t size;
+};
+
+/**
+ * Columnar file of a component container, @see Ecs::exportColumns()
+ * The header is followed by columnCount ColumnDescriptors and then row
+ * groups, one per dense chunk: a std::uint32_t row count, the entity ids
+ * as std::uint32_t, and the values of each column, rows * size bytes each.
+ */
+struct ColumnsHeader {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t componentSize;
+    std::uint32_t columnCount;
+    std::uint32_t rowCount;
+};
+
+struct ColumnDescriptor {
+    char name[32];
+    std::uint32_t offset; // In the component
+    std::uint32_t size;
+};
+
+/**
+ * Memory of a world loaded from a snapshot, @see Ecs::loadSnapshot()
+ * The file is mapped copy-on-write, so changes to the world never reach the
+ * file. Owns the mapping, it must outlive any use of the loaded world.
+ */
+class SnapshotMapping {
+public:
+    SnapshotMapping()
+    {
+    }
+
+    SnapshotMapping(SnapshotMapping&& other) noexcept
+        : memory{other.memory}, reserved{other.reserved}
+    {
+        other.memory = nullptr;
+        other.reserved = 0;
+    }
+
+    SnapshotMapping& operator=(SnapshotMapping&& other) noexcept
+    {
+        std::swap(memory, other.memory);
+        std::swap(reserved, other.reserved);
+        return *this;
+    }
+
+    ~SnapshotMapping()
+    {
+        release();
+    }
+
+    explicit operator bool() const
+    {
+        return memory != nullptr;
+    }
+
+    char* data() const
+    {
+        return memory;
+    }
+
+    /**
+     * @brief Maps the first fileSize bytes of a file, followed by zeroed
+     * memory up to reservedSize.
+     * Without mmap support the file is read instead.
+     */
+    bool map(const char* path, std::size_t fileSize, std::size_t reservedSize)
+    {
+        release();
+#ifdef TECS_HAS_MMAP
+        void* region = ::mmap(nullptr, reservedSize, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED) {
+            return false;
+        }
+        memory = (char*)region;
+        reserved = reservedSize;
+
+        const int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            release();
+            return false;
+        }
+        // Pages of the file replace the start of the reserved region
+        void* file = ::mmap(memory, fileSize, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_FIXED, fd, 0);
+        ::close(fd);
+        if (file == MAP_FAILED) {
+            release();
+            return false;
+        }
+#else
+        std::FILE* file = std::fopen(path, "rb");
+        if (file == nullptr) {
+            return false;
+        }
+        memory = new char[reservedSize]();
+        reserved = reservedSize;
+        const bool read = std::fread(memory, 1, fileSize, file) == fileSize;
+        std::fclose(file);
+        if (!read) {
+            release();
+            return false;
+        }
+#endif
+        return true;
+    }
+
+#ifdef TECS_HAS_MMAP
+    /**
+     * @brief Maps a file copy-on-write: pages are shared with the file
+     * until written. @see Ecs::forkInto()
+     */
+    bool mapPrivate(int fd, std::size_t size)
+    {
+        release();
+        void* region = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (region == MAP_FAILED) {
+            return false;
+        }
+        memory = (char*)region;
+        reserved = size;
+        return true;
+    }
+#endif
+
+    void release()
+    {
+        if (memory == nullptr) {
+            return;
+        }
+#ifdef TECS_HAS_MMAP
+        ::munmap(memory, reserved);
+#else
+        delete[] memory;
+#endif
+        memory = nullptr;
+        reserved = 0;
+    }
+
+private:
+    char* memory = nullptr;
+    std::size_t reserved = 0;
+};
+
+#ifdef TECS_HAS_MMAP
+/**
+ * Arena memory backed by an anonymous shared file, so worlds in it can be
+ * forked copy-on-write, @see Ecs::forkInto()
+ */
+class ForkableMemory {
+public:
+    ForkableMemory()
+    {
+    }
+
+    ForkableMemory(const ForkableMemory&) = delete;
+    ForkableMemory& operator=(const ForkableMemory&) = delete;
+
+    ~ForkableMemory()
+    {
+        release();
+    }
+
+    explicit operator bool() const
+    {
+        return memory != nullptr;
+    }
+
+    /**
+     * @brief Creates the file and maps it, zeroed.
+     *
+     * @param size bytes of memory, to be given to an ArenaAllocator
+     */
+    bool create(u32 size)
+    {
+        release();
+#if defined(__linux__)
+        fd = ::memfd_create("tecs", 0);
+#else
+        char name[32];
+        std::snprintf(name, sizeof(name), "/tecs-%ld", (long)::getpid());
+        fd = ::shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        ::shm_unlink(name);
+#endif
+        if (fd < 0) {
+            return false;
+        }
+        void* region = MAP_FAILED;
+        if (::ftruncate(fd, size) == 0) {
+            region = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (region == MAP_FAILED) {
+            release();
+            return false;
+        }
+        memory = (char*)region;
+        total = size;
+        return true;
+    }
+
+    char* data() const
+    {
+        return memory;
+    }
+
+    u32 size() const
+    {
+        return total;
+    }
+
+    int file() const
+    {
+        return fd;
+    }
+
+    void release()
+    {
+        if (memory != nullptr) {
+            ::munmap(memory, total);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        memory = nullptr;
+        total = 0;
+        fd = -1;
+    }
+
+private:
+    char* memory = nullptr;
+    u32 total = 0;
+    int fd = -1;
+};
+#endif
+
+#if TECS_ACCESS_CHECKS
+/**
+ * Collects the component accesses of the system running on a thread, set
+ * by SystemScheduler while running it.
+ */
+struct AccessRecorder {
+    u32 system;
+    const BitsetWord* declaredReads; // Accesses counted as reads, others as writes
+    std::atomic<std::uint64_t>* readers; // Systems reading each component type
+    std::atomic<std::uint64_t>* writers; // Systems writing each component type
+};
+
+inline thread_local AccessRecorder* currentAccessRecorder = nullptr;
+
+inline void recordAccess(u32 type)
+{
+    const AccessRecorder* recorder = currentAccessRecorder;
+    if (recorder == nullptr) {
+        return;
+    }
+    // Components are accessed by mutable reference, so anything not
+    // declared as read may be written
+    const bool reads = (recorder->declaredReads[type / BitsPerWord] >> (type % BitsPerWord)) & 1;
+    std::atomic<std::uint64_t>& systems = (reads ? recorder->readers : recorder->writers)[type];
+    const std::uint64_t bit = std::uint64_t(1) << recorder->system;
+    if ((systems.load(std::memory_order_relaxed) & bit) == 0) {
+        systems.fetch_or(bit, std::memory_order_relaxed);
+    }
+}
+#endif
+
+/**
+ * Components of one type staged by one thread, to be added to the Ecs in
+ * bulk, @see Ecs::prepareStaged() and Ecs::mergeStaged().
+ * The memory comes from an arena owned by the caller.
+ */
+template <typename T>
+class ComponentStaging {
+public:
+    ComponentStaging() = default;
+    ComponentStaging(ArenaAllocator& arena, u32 capacity)
+        : entityHandles(arena.alloc<EntityHandle>(capacity)),
+          componentData(arena.alloc<T>(capacity)),
+          capacity(capacity)
+    {
+    }
+
+    /**
+     * @brief Stages a component for an entity, which must not have it yet.
+     *
+     * @return the staged component data
+     */
+    T& add(EntityHandle entity)
+    {
+        TECS_ASSERT_CONCURRENT(count < capacity, "Staging is full!");
+        entityHandles[count] = entity;
+        return componentData[count++];
+    }
+
+    void clear()
+    {
+        count = 0;
+    }
+
+    u32 size() const
+    {
+        return count;
+    }
+
+    const EntityHandle* entities() const
+    {
+        return entityHandles;
+    }
+
+    const T* components() const
+    {
+        return componentData;
+    }
+
+private:
+    EntityHandle* entityHandles = nullptr;
+    T* componentData = nullptr;
+    u32 capacity = 0;
+    u32 count = 0;
+};
+
+/**
+ *
+ * @brief Entity Managing Class. Responsible for the creation and removal of
+ * entities and components.
+ * Requires a ArenaAllocator to perform memory allocations.
+ * The Ecs will only use memory available in the ArenaAllocator for dynamic
+ * allocations.
+ * The memory in ArenaAllocator is never freed and always recycled.
+ * Make sure to provide a big enough chunk of memory for your use case.
+ *
+ * @param TypeProvider A class that provides a static TypeId<T>() call to fetch
+ * component type id.
+ * component types must be sequential and begin from 1
+ * @param MaxComponents_ Limit the amount of component types accepted.
+ * Doesn't need to be an exact number, but must be AT LEAST the total types that
+ * will be ever used. Base component container chunks are stored in the class
+ * stack.
+ *
+**/
+template <typename TypeProvider, unsigned char MaxComponents_>
+class Ecs {
+protected:
+    struct TEntity {
+        EntityHandle handle;
+        // Maybe store something else?
+    };
+
+public:
+    static constexpr auto MaxComponents = MaxComponents_;
+    using Types = TypeProvider;
+    using Entity = TEntity;
+
+    /**
+    * @brief Default constructor provided for convinience.
+    * Should be initialized by calling @see init()
+    */
+    Ecs()
+    {
+    }
+
+    /**
+    * @brief Contructor with arena allocator and max entities.
+    * Max entities is required to allocate the space for containing
+    * these entities up-front.
+    * This avoids the need to check/create chunk for entities.
+    *
+    * @param arenaAllocator ArenaAllocator already initialized with memory
+    * @param maxEntities Maximum number of entities that the Ecs is expected to
+    * have
+    *
+    * TODO: Accept 0 as "unbounded" option.
+    */
+    Ecs(ArenaAllocator&& arenaAllocator, u32 maxEntities = 100'000)
+    {
+        init(std::move(arenaAllocator), maxEntities);
+    }
+
+    /**
+    * @brief initializes the Ecs structure.
+    *
+    * @param arenaAllocator ArenaAllocator already initialized with memory
+    * @param maxEntities Maximum number of entities that the Ecs is expected to
+    * have
+    */
+    void init(ArenaAllocator&& arenaAllocator, u32 maxEntities)
+    {
+        this->maxEntities = maxEntities;
+        allocator = arenaAllocator;
+        entities = allocator.allocOffset<Entity>(maxEntities + 1); // 0 is reserved
+        liveEntities = 0;
+        containers = {};
+        freeEntities = 0;
+        destroyedEntities = 0;
+        entityIds = 0;
+        journal = 0;
+        disabledEntities = {};
+        disabledCount = 0;
+        regions = {};
+        regionCount = 0;
+        emptyDenseChunk = 0;
+        regionPages = 0;
+    }
+
+    /**
+    * @brief Creates a new entity
+    *
+    * @return Returns a EntityHandle to be used for further operations @see
+    * addComponent(), removeEntity()
+    */
+    EntityHandle newEntity()
+    {
+        u32 newId;
+        u32 generation = 0;
+        if (std::uint32_t(freeEntities) > 0) {
+            newId = std::uint32_t(freeEntities);
+            ++liveEntities;
+            // Destroyed entities keep the next free id in their handle id,
+            // and the generation to tell their handles apart from new ones
+            const EntityHandle prevHandle = entityArray()[newId].handle;
+            freeEntities = (freeEntities & FreeEntitiesTagMask) | prevHandle.id;
+            generation = prevHandle.generation;
+        }
+        else {
+            ++liveEntities;
+            newId = ++entityIds;
+            TECS_ASSERT(newId <= maxEntities, "Can't create more entities!");
+        }
+
+        Entity& e = entityArray()[newId];
+        u32 id = newId;
+        // TODO: Consider a bitfield variable for checking component handles
+        // so we dont need to clean up the handles list
+        e = {};
+        e.handle.generation = generation;
+        e.handle.id = id;
+        e.handle.alive = 1;
+        appendJournal(JournalOp::NewEntity, id);
+        return e.handle;
+    }
+
+    /**
+    * @brief Reserves a region of the world. Entities created in it are
+    * dropped all at once by unloadRegion(), which gives their memory back
+    * to the region.
+    * Ids are reserved in whole sparse pages, and each component type used
+    * by the region entities takes whole dense chunks of its memory.
+    *
+    * @param size bytes of the arena for the dense chunks and sparse pages
+    * of the region entities
+    * @param maxEntities entity ids reserved for the region
+    */
+    RegionHandle createRegion(u32 size, u32 maxEntities)
+    {
+        TECS_ASSERT(regionCount < MaxRegions, "Can't create more regions!");
+        const u32 page = ComponentContainer().idChunkSize;
+        Region& r = regions[regionCount];
+        // Ids up to the next page are skipped, so no page is shared
+        r.firstEntity = (entityIds / page + 1) * page;
+        r.entityCapacity = (maxEntities + page - 1) / page * page;
+        TECS_ASSERT(r.firstEntity + r.entityCapacity - 1 <= this->maxEntities,
+                    "Can't create more entities!");
+        entityIds = r.firstEntity + r.entityCapacity - 1;
+        std::memset(entityArray() + r.firstEntity, 0, sizeof(Entity) * r.entityCapacity);
+
+        r.memory = allocator.allocOffset<char>(size);
+        r.size = size;
+        r.used = 0;
+        r.entityCount = 0;
+        r.freeEntities = 0;
+        r.containers = allocator.allocOffset<RegionContainer>(MaxComponents);
+        std::memset(allocator.at<RegionContainer>(r.containers), 0, sizeof(RegionContainer) * MaxComponents);
+        if (emptyDenseChunk == 0) {
+            const u32 chunkSize = (this->maxEntities / MaxComponentChunks) + 1;
+            emptyDenseChunk = allocator.allocOffset<EntityHandle>(chunkSize);
+            std::memset(allocator.at<EntityHandle>(emptyDenseChunk), 0, sizeof(EntityHandle) * chunkSize);
+        }
+        if (regionPages == 0) {
+            const u32 pageCount = this->maxEntities / page + 1;
+            regionPages = allocator.allocOffset<std::uint8_t>(pageCount);
+            std::memset(allocator.at<std::uint8_t>(regionPages), 0, pageCount);
+        }
+        std::memset(allocator.at<std::uint8_t>(regionPages) + r.firstEntity / page,
+                    int(regionCount + 1), r.entityCapacity / page);
+        return ++regionCount;
+    }
+
+    /**
+    * @brief Creates a new entity in a region, @see createRegion()
+    *
+    * @param region 0 for the rest of the world
+    */
+    EntityHandle newEntity(RegionHandle region)
+    {
+        if (region == 0) {
+            return newEntity();
+        }
+        TECS_ASSERT(region <= regionCount, "Bad region handle");
+        Region& r = regions[region - 1];
+        u32 id;
+        if (r.freeEntities > 0) {
+            id = r.freeEntities;
+            r.freeEntities = entityArray()[id].handle.id;
+        }
+        else {
+            TECS_ASSERT(r.entityCount < r.entityCapacity, "Can't create more entities in the region!");
+            id = r.firstEntity + r.entityCount++;
+        }
+        ++liveEntities;
+
+        // Ids are reused after an unload, their generation tells the
+        // handles apart
+        Entity& e = entityArray()[id];
+        const u32 generation = e.handle.generation;
+        e = {};
+        e.handle.generation = generation;
+        e.handle.id = id;
+        e.handle.alive = 1;
+        appendJournal(JournalOp::NewEntity, id, region);
+        return e.handle;
+    }
+
+    /**
+    * @brief Drops all the entities of a region without destroying them one
+    * by one: their ids, sparse pages and dense chunks are released
+    * wholesale, and the region memory can be filled again.
+    * Handles of the dropped entities become invalid. Entities destroyed
+    * concurrently are collected first, as their ids are linked through the
+    * entities array.
+    */
+    void unloadRegion(RegionHandle region)
+    {
+        TECS_ASSERT((region > 0 && region <= regionCount), "Bad region handle");
+        collectDestroyedEntities();
+        Region& r = regions[region - 1];
+        for (u32 id = r.firstEntity; id < r.firstEntity + r.entityCount; ++id) {
+            Entity& e = entityArray()[id];
+            if (e.handle.alive) {
+                --liveEntities;
+                if (isDisabled(id)) {
+                    disabledEntities.clear(allocator, id);
+                    --disabledCount;
+                }
+            }
+            e.handle.alive = 0;
+            e.handle.generation += 1;
+        }
+
+        RegionContainer* owned = allocator.at<RegionContainer>(r.containers);
+        for (u32 type = 0; type < MaxComponents; ++type) {
+            if (owned[type].chunks == 0) {
+                continue;
+            }
+            ComponentContainer& c = containers[type];
+            ArenaOffset* pages = allocator.at<ArenaOffset>(c.sparseIds) + r.firstEntity / c.idChunkSize;
+            std::memset(pages, 0, sizeof(ArenaOffset) * (r.entityCapacity / c.idChunkSize));
+            c.entityBits.clearRange(allocator, r.firstEntity, r.entityCapacity);
+            dropRegionChunks(c, owned[type].chunks);
+            owned[type] = {};
+        }
+        appendJournal(JournalOp::UnloadRegion, r.firstEntity, region);
+        r.used = 0;
+        r.entityCount = 0;
+        r.freeEntities = 0;
+    }
+
+    /**
+     * @brief removes an entity
+     * Does nothing if the entity does not exist.
+     * Associated components are also destroyed.
+     *
+     * @param handle The entity to be removed
+     */
+    void removeEntity(const EntityHandle entityHandle)
+    {
+        if (isEntityHandleValid(entityHandle)) {
+            destroyExistingEntity(entityHandle);
+        }
+    }
+
+    /**
+     * @brief removes an entity
+     * Assumes the entity is valid to be removed.
+     * Use only if known that the entity exists.
+     *
+     * @param handle The entity to be removed
+     */
+    void destroyExistingEntity(const EntityHandle entityHandle)
+    {
+        Entity& e = entityArray()[entityHandle.id];
+
+        // TODO: Consider ways to reduce amount of containers we need to iterate
+        // over
+        u32 index = 0;
+        for (ComponentContainer& container : containers) {
+            eraseComponent(entityHandle, index);
+            ++index;
+        }
+        appendJournal(JournalOp::DestroyEntity, entityHandle.id);
+
+        e.handle.generation += 1;
+        pushFreeEntity(entityHandle.id);
+        --liveEntities;
+    }
+
+    /**
+    * @brief Creates a new entity, safe to call from many threads at once,
+    * along with destroyEntityConcurrent().
+    * Other changes to the Ecs must not run meanwhile. Can't be recorded in
+    * the journal as threads take ids in any order, so a recording journal
+    * is marked as having lost records, @see flushJournal()
+    *
+    * Free ids are popped from a lock-free stack. Its head carries a push
+    * count, so a pop can't succeed on a stale head whose id was popped and
+    * pushed back (ABA). Fresh ids come from an atomic counter.
+    */
+    EntityHandle newEntityConcurrent()
+    {
+        u32 newId = 0;
+        u32 generation = 0;
+        std::uint64_t head = atomicLoad(&freeEntities);
+        while (std::uint32_t(head) != 0) {
+            const EntityHandle entry = loadEntityHandle(std::uint32_t(head));
+            const std::uint64_t next = (head & FreeEntitiesTagMask) | entry.id;
+            if (atomicCompareExchange(&freeEntities, head, next)) {
+                newId = std::uint32_t(head);
+                generation = entry.generation;
+                break;
+            }
+        }
+        if (newId == 0) {
+            newId = atomicFetchAdd(&entityIds, std::uint32_t(1)) + 1;
+            TECS_ASSERT_CONCURRENT(newId <= maxEntities, "Can't create more entities!");
+        }
+        atomicFetchAdd(&liveEntities, u32(1));
+        if (journal != 0 && atomicLoad(&journalRecordsLost) == 0) {
+            atomicStore(&journalRecordsLost, std::uint32_t(1));
+        }
+
+        EntityHandle handle = {};
+        handle.generation = generation;
+        handle.id = newId;
+        handle.alive = 1;
+        storeEntityHandle(newId, handle);
+        return handle;
+    }
+
+    /**
+    * @brief Destroys an entity, safe to call from many threads at once,
+    * along with newEntityConcurrent().
+    * The handle is invalid right away, but containers are not thread safe:
+    * the components stay until collectDestroyedEntities() removes them and
+    * frees the id. Until then, forEach still visits them.
+    *
+    * @return false if the handle was not valid, e.g. destroyed meanwhile
+    */
+    bool destroyEntityConcurrent(const EntityHandle entityHandle)
+    {
+        // Only one thread can turn the live handle into a destroyed one
+        EntityHandle destroyed = entityHandle;
+        destroyed.alive = 0;
+        destroyed.generation += 1;
+        destroyed.id = 0;
+        std::uint64_t* word = (std::uint64_t*)&entityArray()[entityHandle.id].handle;
+        std::uint64_t expected = *(const std::uint64_t*)&entityHandle;
+        if (!entityHandle.alive ||
+            !atomicCompareExchange(word, expected, *(const std::uint64_t*)&destroyed)) {
+            return false;
+        }
+
+        // Nobody pops this list concurrently, so it has no ABA issue
+        std::uint32_t head = atomicLoad(&destroyedEntities);
+        do {
+            destroyed.id = head;
+            storeEntityHandle(entityHandle.id, destroyed);
+        } while (!atomicCompareExchange(&destroyedEntities, head,
+                                        std::uint32_t(entityHandle.id)));
+        return true;
+    }
+
+    /**
+    * @brief Removes the components of the entities destroyed with
+    * destroyEntityConcurrent() and frees their ids.
+    * Must not run concurrently with other changes to the Ecs.
+    */
+    void collectDestroyedEntities()
+    {
+        std::uint32_t id = destroyedEntities;
+        destroyedEntities = 0;
+        while (id != 0) {
+            Entity& e = entityArray()[id];
+            const std::uint32_t next = e.handle.id;
+            EntityHandle handle = e.handle;
+            handle.id = id;
+            for (u32 type = 0; type < MaxComponents; ++type) {
+                eraseComponent(handle, type);
+            }
+            appendJournal(JournalOp::DestroyEntity, id);
+            pushFreeEntity(id);
+            --liveEntities;
+            id = next;
+        }
+    }
+
+    /**
+     * @brief Check if an entity handle is valid
+     *
+     * @param handle the entity handle
+     *
+     * @return true if the entity is alive and is from the same generation.
+     */
+    bool isEntityHandleValid(EntityHandle handle)
+    {
+        return isEntityAlive(handle) &&
+               entityArray()[handle.id].handle.generation == handle.generation;
+    }
+
+    /**
+     * @brief Add a component to an entity. The entity must exist!
+     *
+     * @param <T> the componen type
+     * @param entityHandle the entity to add a component
+     */
+    template <typename T>
+    T& addComponent(EntityHandle entityHandle)
+    {
+        static_assert(sizeof(T) >= sizeof(ChunkEmptyEntry));
+        return *(T*)addComponent(entityHandle, TypeProvider::template TypeId<T>(), sizeof(T));
+    }
+
+    /**
+     * @brief Add a component to an entity. The entity must exist!
+     *
+     * @param entityHandle the entity to add a component
+     * @param compTypeId component type id (from TypeProvider)
+     * @param componentSize size of the component type
+     *
+     * @return the component data
+     */
+    void* addComponent(EntityHandle entityHandle, u32 compTypeId, u32 componentSize)
+    {
+        if (isEntityHandleValid(entityHandle)) {
+            ComponentContainer& c = ensureComponentContainer(compTypeId, componentSize);
+            const RegionHandle region = entityRegion(entityHandle.id);
+
+            const u32 sparseEntityIdx = entityHandle.id / c.idChunkSize;
+            const u32 denseEntityIdx = entityHandle.id % c.idChunkSize;
+            ArenaOffset& sparsePageOffset = allocator.at<ArenaOffset>(c.sparseIds)[sparseEntityIdx];
+            if (sparsePageOffset == 0) {
+                // This id was not in the set, so the entity does not have the
+                // component.
+
+                // Allocate sparse id chunk
+                sparsePageOffset = region > 0
+                                       ? allocRegionMemory(regions[region - 1], sizeof(u32) * c.idChunkSize)
+                                       : allocator.allocOffset<u32>(c.idChunkSize);
+                std::memset(allocator.at<u32>(sparsePageOffset), 0, sizeof(u32) * c.idChunkSize);
+            }
+            else {
+                u32 possibleHandle = allocator.at<u32>(sparsePageOffset)[denseEntityIdx];
+                if (isComponentHandleValid(c, possibleHandle)) {
+                    // Entity already contains the component
+                    return accessComponentData(c, possibleHandle);
+                }
+            }
+
+            // Recycle a free component handle if possible, otherwise
+            // add next available dense index as the new component
+            u32 componentHandle;
+            if (region > 0) {
+                componentHandle = regionComponentHandle(c, compTypeId, region);
+            }
+            else if (isComponentHandleValid(c, c.freeComponentHandle.nextFree)) {
+                componentHandle = c.freeComponentHandle.nextFree;
+                forwardFreeIndex(c);
+            }
+            else {
+                componentHandle = ++c.highestHandle;
+            }
+            allocator.at<u32>(sparsePageOffset)[denseEntityIdx] = componentHandle;
+            void* component = accessComponentData(c, componentHandle);
+            pushDenseEntity(c, componentHandle, entityHandle);
+            appendJournal(JournalOp::AddComponent, entityHandle.id, compTypeId, componentSize);
+            return component;
+        }
+        // TODO: Change this to use reserved space from component 0
+        // This can be used to check if the user is using a bad component
+        // doing some memory checking.
+        // for now throws
+        throw("Bad entity handle");
+    }
+
+    /**
+    * @brief Prepares the containers to merge staged components, must run
+    * before the mergeStaged() calls.
+    * Allocates what the merge needs and records the additions in the
+    * journal, as the merge itself can't touch the arena.
+    *
+    * @param stagings the stagings of all threads, with distinct entities
+    * that don't have the component yet
+    * @param count amount of stagings
+    */
+    template <typename T>
+    void prepareStaged(const ComponentStaging<T>* stagings, u32 count)
+    {
+        const u32 typeId = TypeProvider::template TypeId<T>();
+        ComponentContainer& c = ensureComponentContainer(typeId, sizeof(T));
+        u32 total = 0;
+        for (u32 s = 0; s < count; ++s) {
+            const EntityHandle* entities = stagings[s].entities();
+            for (u32 i = 0; i < stagings[s].size(); ++i) {
+                const EntityHandle entity = entities[i];
+                TECS_ASSERT(isEntityHandleValid(entity), "Bad entity handle");
+                TECS_ASSERT(entityRegion(entity.id) == 0, "Region entities can't be staged!");
+                ArenaOffset& page = allocator.at<ArenaOffset>(c.sparseIds)[entity.id / c.idChunkSize];
+                if (page == 0) {
+                    page = allocator.allocOffset<u32>(c.idChunkSize);
+                    std::memset(allocator.at<u32>(page), 0, sizeof(u32) * c.idChunkSize);
+                }
+                TECS_ASSERT(!isComponentHandleValid(c, sparseId(c, entity.id)),
+                            "Entity already has the staged component!");
+                c.highestEntity = entity.id > c.highestEntity ? entity.id : c.highestEntity;
+                appendJournal(JournalOp::AddComponent, entity.id, typeId, sizeof(T));
+            }
+            total += stagings[s].size();
+        }
+        if (total == 0) {
+            return;
+        }
+
+        // Threads take their ranges in any order
+        c.sortedByEntity = false;
+        const ComponentHandle first = c.highestHandle + 1;
+        const ComponentHandle last = c.highestHandle + total;
+        TECS_ASSERT(last <= c.chunkSize * MaxComponentChunks, "no enough space!");
+        for (ComponentHandle handle = first; handle <= last;
+             handle = (handle / c.chunkSize + 1) * c.chunkSize) {
+            accessComponentData(c, handle);
+        }
+    }
+
+    /**
+    * @brief Adds the components of a staging, safe to call from many threads
+    * at once, one per staging given to the last prepareStaged().
+    * Reserves a contiguous range of dense entries with a single atomic add,
+    * holes left by removed components are not reused.
+    * Nothing else may access the Ecs meanwhile.
+    */
+    template <typename T>
+    void mergeStaged(const ComponentStaging<T>& staging)
+    {
+        ComponentContainer& c = containers[TypeProvider::template TypeId<T>()];
+        const u32 count = staging.size();
+        if (count == 0) {
+            return;
+        }
+        const ComponentHandle first = atomicFetchAdd(&c.highestHandle, u32(count)) + 1;
+        atomicFetchAdd(&c.aliveComponents, u32(count));
+
+        const EntityHandle* entities = staging.entities();
+        for (u32 i = 0; i < count;) {
+            // Copy runs that fit in one dense chunk
+            const ComponentHandle handle = first + i;
+            const u32 run = std::min(count - i, c.chunkSize - handle % c.chunkSize);
+            std::memcpy(&denseEntity(c, handle), entities + i, sizeof(EntityHandle) * run);
+            std::memcpy(denseComponent(c, handle), staging.components() + i, sizeof(T) * run);
+            for (u32 j = i; j < i + run; ++j) {
+                sparseId(c, entities[j].id) = first + j;
+                c.entityBits.setConcurrent(allocator, entities[j].id);
+            }
+            i += run;
+        }
+    }
+
+    /**
+     * @brief Stores a template entity with the given component values.
+     * The containers of the components are created now, so instantiating
+     * does not look them up per entity.
+     */
+    template <typename... Components>
+    Prefab definePrefab(const Components&... components)
+    {
+        Prefab prefab;
+        prefab.componentCount = sizeof...(Components);
+        prefab.components = allocator.allocOffset<PrefabComponent>(sizeof...(Components));
+        PrefabComponent* entry = allocator.at<PrefabComponent>(prefab.components);
+        auto store = [&](u32 type, const void* component, u32 size) {
+            ensureComponentContainer(type, size);
+            entry->type = type;
+            entry->data = allocator.allocOffset<char>(size);
+            std::memcpy(allocator.at<char>(entry->data), component, size);
+            ++entry;
+        };
+        (store(TypeProvider::template TypeId<Components>(), &components, sizeof(Components)), ...);
+        return prefab;
+    }
+
+    /**
+     * @brief Creates count entities with the components of a prefab.
+     * Each container gets one contiguous dense range, filled with copies of
+     * the prefab values in bulk. Holes left by removed components are not
+     * reused.
+     *
+     * @param out receives the new entity handles if not null
+     */
+    void instantiate(const Prefab& prefab, u32 count, EntityHandle* out = nullptr)
+    {
+        // Entities are created in batches, each appended to every container
+        // in turn, so the dense ranges still follow each other
+        EntityHandle batch[InstantiateBatch];
+        for (u32 done = 0; done < count; done += InstantiateBatch) {
+            const u32 batchCount = std::min(count - done, InstantiateBatch);
+            for (u32 i = 0; i < batchCount; ++i) {
+                batch[i] = newEntity();
+            }
+            const PrefabComponent* components = allocator.at<PrefabComponent>(prefab.components);
+            for (u32 p = 0; p < prefab.componentCount; ++p) {
+                ComponentContainer& c = containers[components[p].type];
+                const char* component = allocator.at<char>(components[p].data);
+                appendComponents(c, batch, batchCount, [&](u32, u32 run, char* destination) {
+                    fillCopies(destination, component, c.componentSize, run);
+                });
+                for (u32 i = 0; i < batchCount; ++i) {
+                    appendJournal(JournalOp::AddComponent, batch[i].id, components[p].type,
+                                  containers[components[p].type].componentSize);
+                }
+            }
+            if (out != nullptr) {
+                std::memcpy(out + done, batch, sizeof(EntityHandle) * batchCount);
+            }
+        }
+    }
+
+    /**
+     * @brief Creates a new entity with copies of the components of another.
+     * The copy is disabled if the original is, @see setEntityEnabled()
+     *
+     * @return the copy
+     */
+    EntityHandle cloneEntity(EntityHandle entity)
+    {
+        EntityHandle copy;
+        cloneEntities(&entity, 1, &copy);
+        return copy;
+    }
+
+    /**
+     * @brief Clones many entities, appending the components of the copies
+     * container by container, @see cloneEntity()
+     *
+     * @param out receives the count copies
+     */
+    void cloneEntities(const EntityHandle* entities, u32 count, EntityHandle* out)
+    {
+        copyEntities(*this, entities, count, out);
+    }
+
+    /**
+     * @brief Moves an entity and its components to another world. The
+     * entity is destroyed here.
+     *
+     * @param dst world with the same component types
+     *
+     * @return the entity in dst
+     */
+    EntityHandle moveEntity(EntityHandle entity, Ecs& dst)
+    {
+        EntityHandle moved;
+        moveEntities(&entity, 1, dst, &moved);
+        return moved;
+    }
+
+    /**
+     * @brief Moves many entities to another world, appending their
+     * components container by container, @see moveEntity()
+     *
+     * @param out receives the count entities in dst
+     */
+    void moveEntities(const EntityHandle* entities, u32 count, Ecs& dst, EntityHandle* out)
+    {
+        TECS_ASSERT(&dst != this, "Moving entities within the same world!");
+        copyEntities(dst, entities, count, out);
+        for (u32 i = 0; i < count; ++i) {
+            destroyExistingEntity(entities[i]);
+        }
+    }
+
+    /**
+     * @brief Moves all the entities of another world into this one, which
+     * must have room for them. other is left empty, ready to be filled
+     * again.
+     *
+     * Each container of other is appended in bulk in dense order: adjacent
+     * entries are copied with a single memcpy.
+     * Entities destroyed concurrently in other are collected first. Entities
+     * of the regions of other become entities of this world outside any
+     * region, and the regions of other are reset with the rest of it.
+     *
+     * @return the handle in this world of each entity of other, indexed by
+     * its id in other. Unused ids map to an invalid handle.
+     */
+    std::vector<EntityHandle> merge(Ecs&& other)
+    {
+        TECS_ASSERT(&other != this, "Merging a world into itself!");
+        other.collectDestroyedEntities();
+        std::vector<EntityHandle> remap(other.entityIds + 1);
+        for (u32 id = 1; id <= other.entityIds; ++id) {
+            if (other.entityArray()[id].handle.alive) {
+                remap[id] = newEntity();
+                if (other.isDisabled(id)) {
+                    setEntityEnabled(remap[id], false);
+                }
+            }
+        }
+
+        EntityHandle owners[InstantiateBatch];
+        const char* sources[InstantiateBatch];
+        for (u32 type = 0; type < MaxComponents; ++type) {
+            ComponentContainer& c = other.containers[type];
+            if (c.componentSize == 0 || c.aliveComponents == 0) {
+                continue;
+            }
+            const u32 size = c.componentSize;
+            ComponentContainer& target = ensureComponentContainer(type, size);
+            DenseCursor cursor = {&c, &other.allocator};
+            cursor.seek(0);
+            bool more = cursor.next();
+            while (more) {
+                u32 found = 0;
+                do {
+                    owners[found] = remap[cursor.entity->id];
+                    sources[found++] = cursor.data;
+                    more = cursor.next();
+                } while (more && found < InstantiateBatch);
+
+                appendComponents(target, owners, found, [&](u32 first, u32 run, char* destination) {
+                    for (u32 j = 0; j < run;) {
+                        const char* source = sources[first + j];
+                        u32 adjacent = 1;
+                        while (j + adjacent < run && sources[first + j + adjacent] == source + adjacent * size) {
+                            ++adjacent;
+                        }
+                        std::memcpy(destination + j * size, source, adjacent * size);
+                        j += adjacent;
+                    }
+                });
+                for (u32 i = 0; i < found; ++i) {
+                    appendJournal(JournalOp::AddComponent, owners[i].id, type, size);
+                }
+            }
+        }
+
+        other.init(ArenaAllocator(other.allocator.memory(), other.allocator.size()), other.maxEntities);
+        return remap;
+    }
+
+    /**
+     * @brief Get a component from an entity. 
+     *
+     * @param <T> the componen type
+     * @param entityHandle the entity to add a component
+     *
+     * @return null if not found. Valid pointer otherwise.
+     *
+    */
+    template <typename T>
+    T* getComponent(EntityHandle entityHandle)
+    {
+        static_assert(sizeof(T) >= sizeof(ChunkEmptyEntry));
+        if (isEntityHandleValid(entityHandle)) {
+            u32 compTypeId = TypeProvider::template TypeId<T>();
+            TECS_RECORD_ACCESS(compTypeId);
+
+            ComponentContainer& c = ensureComponentContainer(compTypeId, sizeof(T));
+
+            const u32 idContainer = entityHandle.id / c.idChunkSize;
+            const u32 denseEntityIdx = entityHandle.id % c.idChunkSize;
+            u32* sparsePage = sparseIdPage(c, idContainer);
+            if (sparsePage == nullptr) {
+                return nullptr;
+            }
+            else {
+                u32 possibleHandle = sparsePage[denseEntityIdx];
+                if (isComponentHandleValid(c, possibleHandle)) {
+                    // Entity already contains the component
+                    return (T*)accessComponentData(c, possibleHandle);
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief Access existing entity component's data
+     * No checks are made, use only if you know the entity and component exists.
+     * Otherwise, undefined behavior
+     *
+     * @param <T> The component type
+     * @param entity the entity handle
+     *
+     * @return the pointer
+     */
+    template <typename T>
+    T* accessExistingComponentData(u32 entity)
+    {
+        return (T*)accessExistingComponentData(TypeProvider::template TypeId<T>(), entity);
+    }
+
+    /**
+     * @brief Access existing entity component's data
+     * No checks are made, use only if you know the entity and component exists.
+     * Otherwise, undefined behavior
+     *
+     * @param type The component type
+     * @param entity the entity handle
+     *
+     * @return the pointer
+     */
+    void* accessExistingComponentData(u32 type, u32 entity)
+    {
+        TECS_RECORD_ACCESS(type);
+        ComponentContainer& c = containers[type];
+        const ComponentHandle handle = sparseId(c, entity);
+        markChunkChanged(c, handle);
+        return denseComponent(c, handle);
+    }
+
+    /**
+     * @brief Removes the component from a entity.
+     * Does nothing if the entity is invalid.
+     *
+     * @param <T> component type
+     * @param entity the entity
+     */
+    template <typename T>
+    void removeComponent(EntityHandle entityHandle)
+    {
+        removeComponent(entityHandle, TypeProvider::template TypeId<T>());
+    }
+
+    /**
+     * @brief Removes the component from a entity.
+     * Does nothing if the entity is invalid.
+     *
+     * @param entity the entity
+     * @param componentType component type id (from TypeProvider)
+     */
+    void removeComponent(EntityHandle entityHandle, u32 compTypeId)
+    {
+        if (isEntityHandleValid(entityHandle)) {
+            removeComponentOfExistingEntity(entityHandle, compTypeId);
+        }
+        else {
+            TECS_LOG_ERROR(
+                "Trying to remove component of invalid entity handle! " << entityHandle);
+        }
+    }
+
+    /**
+     * @brief Removes the component from an existing entity.
+     * Slight optimized version of removeComponent(entity).
+     * Use if you know that the entity is valid.
+     *
+     * @param entity the entity
+     * @param componentType component type id (from TypeProvider)
+     */
+    void removeComponentOfExistingEntity(EntityHandle entityHandle, u32 componentType)
+    {
+        if (eraseComponent(entityHandle, componentType)) {
+            appendJournal(JournalOp::RemoveComponent, entityHandle.id, componentType);
+        }
+    }
+
+    /**
+     * @brief Check if the entity has a component
+     *
+     * @param entity the entity handle to be checked
+     *
+     * @return false if the entity is invalid or does not have the component,
+     * true otherwise.
+     **/
+    template <typename T>
+    bool entityHasComponent(EntityHandle entity)
+    {
+        return entityHasComponent(entity, TypeProvider::template TypeId<T>());
+    }
+
+    /**
+     * @brief Check if the entity has a component
+     *
+     * @param entity the entity handle to be checked
+     * @param componentType the component type (must be same as values provided
+     * by TypeProvider template)
+     *
+     * @return false if the entity is invalid or does not have the component,
+     * true otherwise.
+     **/
+    bool entityHasComponent(EntityHandle entity, u32 componentType)
+    {
+        if (isEntityHandleValid(entity)) {
+            return getExistingEntityComponentHandle(entity.id, componentType) > 0;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Get the component handle for a given entity and component type
+     *
+     * @param <T> the component type
+     * @param handle the entity
+     *
+     * @return the component handle. It may be invalid if the entity does not
+     * exists
+     * or if the entity does not have the component
+     */
+    template <typename T>
+    ComponentHandle getEntityComponentHandle(EntityHandle handle)
+    {
+        return getEntityComponentHandle(handle, TypeProvider::template TypeId<T>());
+    }
+
+    /**
+     * @brief Get the component handle for a given entity and component type
+     *
+     * @param handle the entity
+     * @param componentType the component type
+     *
+     * @return the component handle. It may be invalid if the entity does not
+     * exists
+     * or if the entity does not have the component
+     */
+    ComponentHandle getEntityComponentHandle(EntityHandle handle, u32 componentType)
+    {
+        if (isEntityHandleValid(handle)) {
+            return getExistingEntityComponentHandle(handle.id, componentType);
+        }
+        else {
+            return 0;
+        }
+    }
+
+    /**
+     * @brief get component handle for a entity
+     *
+     * @param entity the entity
+     * @param componentType the component type (from TypeProvider)
+     *
+     * Does not check is entity exists. If it doesnt, undefined behavior.
+     * Only use thing method if you know what you are doing.
+     */
+    ComponentHandle getExistingEntityComponentHandle(u32 entity, u32 componentType)
+    {
+        ComponentContainer& c = containers[componentType];
+        if (c.componentSize == 0) {
+            return 0;
+        }
+        else {
+            u32* sparsePage = sparseIdPage(c, entity / c.idChunkSize);
+            if (sparsePage == nullptr) {
+                return 0;
+            }
+            return sparsePage[entity % c.idChunkSize];
+        }
+    }
+
+    /**
+     * @brief Check if a entity is alive
+     *
+     * @param handle the entity to check.
+     *
+     * @return true if the entity is alive.
+     */
+    bool isEntityAlive(EntityHandle handle)
+    {
+        return entityArray()[handle.id].handle.alive;
+    }
+
+    /**
+     * @return the number of alive entities
+     */
+    u32 getEntityAmount() const
+    {
+        return liveEntities;
+    }
+
+    /**
+     * @brief Enables or disables an entity. Iteration skips disabled
+     * entities, but they keep their components, which can still be
+     * accessed directly. Destroying an entity enables its id again.
+     *
+     * @param handle the entity, does nothing if invalid
+     */
+    void setEntityEnabled(EntityHandle handle, bool enabled)
+    {
+        if (!isEntityHandleValid(handle) || isEntityEnabled(handle) == enabled) {
+            return;
+        }
+        if (disabledEntities.entityWords == 0) {
+            initEntityBitset(disabledEntities);
+        }
+        if (enabled) {
+            disabledEntities.clear(allocator, handle.id);
+            --disabledCount;
+        }
+        else {
+            disabledEntities.set(allocator, handle.id);
+            ++disabledCount;
+        }
+        appendJournal(enabled ? JournalOp::EnableEntity : JournalOp::DisableEntity, handle.id);
+    }
+
+    bool isEntityEnabled(EntityHandle handle) const
+    {
+        return !isDisabled(handle.id);
+    }
+
+    /**
+     * @brief return the amount of currently active components of a given type
+     *
+     * @param type the component type to check
+     *
+     * @return the number of active components of a type
+     */
+    u32 getComponentAmount(u32 type)
+    {
+        if (containers[type].componentSize == 0) {
+            return 0;
+        }
+        else {
+            return containers[type].aliveComponents;
+        }
+    }
+
+    /**
+     * @brief Loops over all entities that contain a given set of components
+     *
+     * @param f a lambda function to be used.
+     * Signature: (EntityHandle handle, Component1& c, Component2& ... etc)
+     */
+    template <typename... Components, typename F>
+    void forEach(F f)
+    {
+        forEach<Components...>(QueryStrategy::Auto, f);
+    }
+
+    /**
+     * @brief Loops over all entities that contain a given set of components
+     *
+     * @param strategy how multiple component containers are joined
+     * @param f a lambda function to be used.
+     * Signature: (EntityHandle handle, Component1& c, Component2& ... etc)
+     */
+    template <typename... Components, typename F>
+    void forEach(QueryStrategy strategy, F f)
+    {
+        (TECS_RECORD_ACCESS(TypeProvider::template TypeId<Components>()), ...);
+        auto plan = planQuery<Components...>(strategy);
+        if (getComponentAmount(plan.drivingType) == 0) {
+            return;
+        }
+        // Callbacks get mutable components. Stored atomically, as systems
+        // sharing components may iterate concurrently
+        (atomicStore(&containers[TypeProvider::template TypeId<Components>()].changedChunks, AllChunks), ...);
+
+        if (disabledCount > 0) {
+            auto enabledOnly = [&](EntityHandle handle, Components&... components) {
+                if (!disabledEntities.test(allocator, handle.id)) {
+                    f(handle, components...);
+                }
+            };
+            runQuery<Components...>(plan, enabledOnly);
+        }
+        else {
+            runQuery<Components...>(plan, f);
+        }
+    }
+
+    /**
+     * @brief Loops over the entities in one dense chunk of the first
+     * component container that have all the other components.
+     * Different chunks never share entities, so they can be iterated
+     * concurrently, @see SystemScheduler::addChunkedSystem()
+     *
+     * @param chunk dense chunk of the first component, below MaxComponentChunks
+     * @param f a lambda function to be used.
+     * Signature: (EntityHandle handle, Driver& c, Component2& ... etc)
+     */
+    template <typename Driver, typename... Components, typename F>
+    void forEachInChunk(u32 chunk, F f)
+    {
+        TECS_RECORD_ACCESS(TypeProvider::template TypeId<Driver>());
+        (TECS_RECORD_ACCESS(TypeProvider::template TypeId<Components>()), ...);
+        ComponentContainer& c = containers[TypeProvider::template TypeId<Driver>()];
+        const ComponentHandle first = std::max(chunk * c.chunkSize, u32(1));
+        if (c.componentSize == 0 || first > c.highestHandle) {
+            return;
+        }
+        const ComponentHandle last = std::min((chunk + 1) * c.chunkSize - 1, c.highestHandle);
+        // Callbacks get mutable components
+        markChunkChanged(c, first);
+        (atomicStore(&containers[TypeProvider::template TypeId<Components>()].changedChunks, AllChunks), ...);
+
+        const EntityHandle* owners = &denseEntity(c, first);
+        Driver* data = (Driver*)denseComponent(c, first);
+        for (u32 i = 0; i <= last - first; ++i) {
+            const u32 entity = owners[i].id;
+            if (entity > 0 && !isDisabled(entity) &&
+                ((getExistingEntityComponentHandle(entity, TypeProvider::template TypeId<Components>()) > 0) && ...)) {
+                f(entityArray()[entity].handle, data[i], *iteratedComponent<Components>(entity)...);
+            }
+        }
+    }
+
+    /**
+     * @brief Continues a pass over the entities with all the components,
+     * until the pass ends or the budget runs out, so heavy passes can be
+     * spread over frames.
+     * The cursor walks the dense entries of the first component container.
+     * Entities removed between calls are not visited, components added
+     * into free entries behind the cursor wait for the next pass. Sorting
+     * the container during a pass may skip or repeat entities.
+     *
+     * @param cursor kept between calls, reset when the pass ends
+     * @param budget the time is checked every BudgetTimeCheckInterval entries
+     * @param f a lambda function to be used.
+     * Signature: (EntityHandle handle, Driver& c, Component2& ... etc)
+     *
+     * @return true if the pass ended, the next call starts a new one
+     */
+    template <typename Driver, typename... Components, typename F>
+    bool forEachBudgeted(IterationCursor& cursor, const IterationBudget& budget, F f)
+    {
+        TECS_RECORD_ACCESS(TypeProvider::template TypeId<Driver>());
+        (TECS_RECORD_ACCESS(TypeProvider::template TypeId<Components>()), ...);
+        ComponentContainer& c = containers[TypeProvider::template TypeId<Driver>()];
+        if (c.componentSize == 0 || cursor.position >= c.highestHandle) {
+            cursor.position = 0;
+            return true;
+        }
+        // Callbacks get mutable components
+        atomicStore(&c.changedChunks, AllChunks);
+        (atomicStore(&containers[TypeProvider::template TypeId<Components>()].changedChunks, AllChunks), ...);
+
+        const auto start = std::chrono::steady_clock::now();
+        DenseCursor dense = {&c, &allocator};
+        dense.seek(cursor.position);
+        u32 processed = 0;
+        u32 visited = 0;
+        while (processed < budget.entities) {
+            if (!dense.next()) {
+                cursor.position = 0;
+                return true;
+            }
+            processed += visitDenseEntry<Driver, Components...>(dense, f);
+            if (++visited % BudgetTimeCheckInterval == 0 &&
+                std::chrono::steady_clock::now() - start >= budget.time) {
+                break;
+            }
+        }
+        cursor.position = dense.position;
+        return false;
+    }
+
+    /**
+     * @brief Processes up to maxCount entities with all the components,
+     * continuing from the cursor and wrapping around at the end of the
+     * first component container, so a pass spreads over several calls.
+     * A call never visits an entity twice. Entities are visited within two
+     * rounds of calls as removals leave holes and insertions fill holes or
+     * append, so no entry moves, except when sorting the container.
+     *
+     * @param cursor kept between calls
+     * @param maxCount matching entities to process
+     * @param f a lambda function to be used.
+     * Signature: (EntityHandle handle, Driver& c, Component2& ... etc)
+     *
+     * @return amount of entities processed
+     */
+    template <typename Driver, typename... Components, typename F>
+    u32 forEachSlice(IterationCursor& cursor, u32 maxCount, F f)
+    {
+        TECS_RECORD_ACCESS(TypeProvider::template TypeId<Driver>());
+        (TECS_RECORD_ACCESS(TypeProvider::template TypeId<Components>()), ...);
+        ComponentContainer& c = containers[TypeProvider::template TypeId<Driver>()];
+        if (c.componentSize == 0 || c.highestHandle == 0) {
+            return 0;
+        }
+        // Callbacks get mutable components
+        atomicStore(&c.changedChunks, AllChunks);
+        (atomicStore(&containers[TypeProvider::template TypeId<Components>()].changedChunks, AllChunks), ...);
+
+        const ComponentHandle start = cursor.position < c.highestHandle ? cursor.position : 0;
+        DenseCursor dense = {&c, &allocator};
+        dense.seek(start);
+        bool wrapped = start == 0;
+        u32 processed = 0;
+        while (processed < maxCount) {
+            if (!dense.next()) {
+                if (wrapped) {
+                    break;
+                }
+                wrapped = true;
+                dense.seek(0);
+                continue;
+            }
+            if (wrapped && start > 0 && dense.position > start) {
+                // Back where this call started
+                cursor.position = start;
+                return processed;
+            }
+            processed += visitDenseEntry<Driver, Components...>(dense, f);
+        }
+        cursor.position = dense.position;
+        return processed;
+    }
+
+    /**
+     * @brief Gather statistics of a component container.
+     *
+     * @param type the component type
+     */
+    ContainerStats getContainerStats(u32 type)
+    {
+        const ComponentContainer& c = containers[type];
+        if (c.componentSize == 0 || c.aliveComponents == 0) {
+            return {type, 0, 0, 0, 0.0f, true};
+        }
+        const u32 occupied = c.entityBits.occupiedBlocks;
+        return {type, c.aliveComponents, c.highestHandle, occupied,
+                float(c.aliveComponents) / float(occupied * BitsetBlockEntities),
+                c.sortedByEntity};
+    }
+
+    /**
+     * @brief Decide how a query over the given components will be executed.
+     *
+     * The smallest container drives the query. The chance of a driving
+     * entity having each other component is estimated from that container
+     * density and how much its occupied blocks overlap the driver ones.
+     * Probing cost grows with the driver size and the probes needed to reject
+     * entities, intersection cost grows with the blocks that must be ANDed.
+     * Both then resolve every component of each match through the sparse ids.
+     * Merging walks all containers, but reads the components in place, and is
+     * only possible when every container is sorted by entity.
+     *
+     * @param strategy Auto to pick the cheapest strategy, or the one to use.
+     * MergeJoin falls back to Auto if any container is not sorted.
+     */
+    template <typename... Components>
+    QueryPlan<sizeof...(Components)> planQuery(QueryStrategy strategy = QueryStrategy::Auto)
+    {
+        constexpr u32 count = sizeof...(Components);
+        ContainerStats stats[] = {getContainerStats(TypeProvider::template TypeId<Components>())...};
+
+        u32 driver = 0;
+        bool sorted = true;
+        float mergeCost = 0.0f;
+        for (u32 i = 0; i < count; ++i) {
+            if (stats[i].count < stats[driver].count) {
+                driver = i;
+            }
+            sorted = sorted && stats[i].sortedByEntity;
+            mergeCost += float(stats[i].slots) * MergeStepCost;
+        }
+
+        QueryPlan<count> plan = {};
+        plan.drivingType = stats[driver].type;
+
+        float passChance[count];
+        u32 probes = 0;
+        u32 fewestBlocks = stats[driver].occupiedBlocks;
+        for (u32 i = 0; i < count; ++i) {
+            if (i == driver) {
+                continue;
+            }
+            float overlap = 0.0f;
+            if (stats[driver].occupiedBlocks > 0) {
+                overlap = float(stats[i].occupiedBlocks) / float(stats[driver].occupiedBlocks);
+                overlap = overlap > 1.0f ? 1.0f : overlap;
+            }
+            fewestBlocks = stats[i].occupiedBlocks < fewestBlocks ? stats[i].occupiedBlocks : fewestBlocks;
+
+            // Insert keeping most selective first
+            const float chance = stats[i].density * overlap;
+            u32 j = probes++;
+            for (; j > 0 && passChance[j - 1] > chance; --j) {
+                passChance[j] = passChance[j - 1];
+                plan.probeTypes[j] = plan.probeTypes[j - 1];
+            }
+            passChance[j] = chance;
+            plan.probeTypes[j] = stats[i].type;
+        }
+
+        float probeCost = float(stats[driver].slots);
+        float reaching = float(stats[driver].count);
+        for (u32 i = 0; i < probes; ++i) {
+            probeCost += reaching * ProbeCost;
+            reaching *= passChance[i];
+        }
+        plan.expectedMatches = reaching;
+
+        if (strategy == QueryStrategy::MergeJoin && !sorted) {
+            strategy = QueryStrategy::Auto;
+        }
+        if (strategy == QueryStrategy::Auto) {
+            const float resolveCost = reaching * count * ResolveCost;
+            probeCost += resolveCost;
+
+            // Every summary word is read, then only blocks present in all
+            const float summaryWords = float(maxEntities / BitsetBlockEntities + 1);
+            const float bitsetCost = summaryWords * count +
+                                     float(fewestBlocks) * BitsPerWord * count * BitsetWordCost +
+                                     resolveCost;
+
+            // Pipelining only pays off once the window can be filled
+            strategy = stats[driver].slots >= PrefetchDistance * 2
+                           ? QueryStrategy::PrefetchedProbeJoin
+                           : QueryStrategy::ProbeJoin;
+            float bestCost = probeCost;
+            if (count > 1 && bitsetCost < bestCost) {
+                strategy = QueryStrategy::BitsetIntersection;
+                bestCost = bitsetCost;
+            }
+            if (count > 1 && sorted && mergeCost < bestCost) {
+                strategy = QueryStrategy::MergeJoin;
+            }
+        }
+        plan.strategy = strategy;
+        return plan;
+    }
+
+    /**
+     * @brief Sorts the dense storage of a component container by entity id.
+     * Holes left by removed components are compacted away.
+     * Invalidates references to components of this type!
+     *
+     * Adding components to entities in increasing id order keeps the
+     * container sorted, allowing forEach to merge join it.
+     *
+     * @param <T> the component type
+     *
+     * @return false if entities of a region have the component, their
+     * chunks can't be sorted, @see createRegion()
+     */
+    template <typename T>
+    bool sortByEntity()
+    {
+        return sortByEntity(TypeProvider::template TypeId<T>());
+    }
+
+    /**
+     * @brief Sorts the dense storage of a component container by entity id.
+     * @see sortByEntity<T>()
+     *
+     * @param type the component type id (from TypeProvider)
+     */
+    bool sortByEntity(u32 type)
+    {
+        ComponentContainer& c = containers[type];
+        if (c.componentSize == 0) {
+            return true;
+        }
+        if (!prepareSorting(c)) {
+            return false;
+        }
+
+        ComponentHandle position = 1;
+        c.entityBits.forEachEntity(allocator, [&](u32 entity) {
+            moveDenseEntry(c, entity, position);
+            ++position;
+        });
+        compactDenseStorage(c);
+        c.sortedByEntity = true;
+        return true;
+    }
+
+    /**
+     * @brief Sorts the dense storage of a component container in place, so
+     * forEach walks the components in the comparator order.
+     * Holes left by removed components are compacted away.
+     * Invalidates references to components of the sorted types!
+     *
+     * @param <T> the component type to sort
+     * @param <Paired> component types to align with T: entities having both
+     * get the same relative order, ahead of the ones without T.
+     * @param comparator strict weak ordering: bool(const T& a, const T& b)
+     *
+     * Temporary memory for sorting is taken from the arena and given back.
+     *
+     * @return false if entities of a region have T or a paired component,
+     * those containers are left as they are, @see sortByEntity()
+     */
+    template <typename T, typename... Paired, typename Compare>
+    bool sort(Compare comparator)
+    {
+        ComponentContainer& c = containers[TypeProvider::template TypeId<T>()];
+        if (c.componentSize == 0) {
+            return true;
+        }
+        if (!prepareSorting(c)) {
+            return false;
+        }
+
+        struct SortEntry {
+            const T* component;
+            u32 entity;
+        };
+        ArenaOffset scratch = allocator.mark();
+        SortEntry* order = allocator.alloc<SortEntry>(c.aliveComponents);
+        u32 count = 0;
+        DenseCursor cursor = {&c, &allocator};
+        cursor.seek(0);
+        while (cursor.next()) {
+            order[count++] = {(const T*)cursor.data, cursor.entity->id};
+        }
+        std::sort(order, order + count, [&](const SortEntry& a, const SortEntry& b) {
+            return comparator(*a.component, *b.component);
+        });
+
+        for (u32 i = 0; i < count; ++i) {
+            moveDenseEntry(c, order[i].entity, i + 1);
+        }
+        compactDenseStorage(c);
+        c.sortedByEntity = count <= 1;
+        allocator.rewind(scratch);
+
+        bool aligned = true;
+        ((aligned = alignDenseStorage(c, containers[TypeProvider::template TypeId<Paired>()]) && aligned), ...);
+        return aligned;
+    }
+
+    /**
+    * @brief Writes the world to a file: a SnapshotHeader, this object and
+    * the used part of the arena, in one sequential pass.
+    *
+    * @return false if the file could not be written
+    */
+    bool saveSnapshot(const char* path) const
+    {
+        SnapshotHeader header = {SnapshotMagic,
+                                 SnapshotVersion,
+                                 MaxComponents,
+                                 sizeof(Ecs),
+                                 snapshotArenaOffset(),
+                                 (std::uint32_t)allocator.usedSize(),
+                                 (std::uint32_t)allocator.size()};
+        std::FILE* file = std::fopen(path, "wb");
+        if (file == nullptr) {
+            return false;
+        }
+        const char padding[SnapshotArenaAlignment] = {};
+        const std::size_t paddingSize = header.arenaOffset - sizeof(header) - sizeof(Ecs);
+        bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                       std::fwrite(this, sizeof(Ecs), 1, file) == 1 &&
+                       std::fwrite(padding, 1, paddingSize, file) == paddingSize &&
+                       std::fwrite(allocator.memory(), 1, header.arenaUsed, file) ==
+                           header.arenaUsed;
+        written = (std::fclose(file) == 0) && written;
+        return written;
+    }
+
+    /**
+    * @brief Replaces this world with a snapshot written by saveSnapshot().
+    * The file is mapped and used in place, with no per entity work, so
+    * queries can run right away. The arena keeps the size it was saved
+    * with, so the world can keep growing.
+    *
+    * Snapshots from another version, with another MaxComponents or
+    * Ecs layout are rejected, leaving this world untouched.
+    *
+    * @param <Components> component types to check: the snapshot is rejected
+    * if it stores any of them with a different size.
+    *
+    * @return the mapping holding the world memory, which must be kept alive
+    * while the world is used. Converts to false if the snapshot was rejected.
+    */
+    template <typename... Components>
+    [[nodiscard]] SnapshotMapping loadSnapshot(const char* path)
+    {
+        SnapshotMapping mapping;
+        SnapshotHeader header;
+        std::FILE* file = std::fopen(path, "rb");
+        if (file == nullptr) {
+            return mapping;
+        }
+        bool valid = std::fread(&header, sizeof(header), 1, file) == 1 &&
+                     std::fseek(file, 0, SEEK_END) == 0;
+        const long fileSize = valid ? std::ftell(file) : 0;
+        std::fclose(file);
+
+        valid = valid && header.magic == SnapshotMagic &&
+                header.version == SnapshotVersion &&
+                header.maxComponents == MaxComponents &&
+                header.worldSize == sizeof(Ecs) &&
+                header.arenaOffset == snapshotArenaOffset() &&
+                header.arenaUsed <= header.arenaSize &&
+                fileSize >= 0 && (std::uint64_t)fileSize ==
+                    (std::uint64_t)header.arenaOffset + header.arenaUsed;
+        if (!valid) {
+            TECS_LOG_ERROR("Incompatible snapshot!");
+            return mapping;
+        }
+        if (!mapping.map(path, fileSize, (std::size_t)header.arenaOffset + header.arenaSize)) {
+            return mapping;
+        }
+
+        Ecs world;
+        std::memcpy((void*)&world, mapping.data() + sizeof(header), sizeof(Ecs));
+        const bool sizesMatch =
+            (world.hasComponentSize(TypeProvider::template TypeId<Components>(),
+                                    sizeof(Components)) && ...);
+        if (!sizesMatch) {
+            TECS_LOG_ERROR("Snapshot component sizes do not match!");
+            mapping.release();
+            return mapping;
+        }
+
+        *this = world;
+        rebind(mapping.data() + header.arenaOffset, header.arenaSize);
+        markAllChanged();
+        // Pending records are part of the snapshot state already
+        journalUsed = 0;
+        return mapping;
+    }
+
+    /**
+    * @brief Encodes the changes from a baseline state of this world.
+    * The used arenas are compared word by word: changed words are XORed
+    * with the baseline and grouped in runs, unchanged ones are skipped,
+    * and the arena allocated since the baseline is sent as is. That covers
+    * created and destroyed entities, added and removed components and
+    * changed component data, with a cost proportional to the used arena.
+    *
+    * A baseline is a copy of the world as the receiver has it, e.g. the
+    * last acknowledged state, @see arena() and rebind() to make one.
+    *
+    * @param baseline earlier state of this world
+    * @param buffer memory to write the delta to
+    * @param capacity bytes available in buffer
+    *
+    * @return bytes written, 0 if the delta didn't fit in the buffer
+    */
+    u32 encodeDelta(const Ecs& baseline, char* buffer, u32 capacity) const
+    {
+        const u32 used = allocator.usedSize();
+        const u32 baselineUsed = baseline.allocator.usedSize();
+        DeltaHeader header = {sizeof(Ecs), (std::uint32_t)baselineUsed, (std::uint32_t)used, 0};
+        u32 written = sizeof(header) + sizeof(Ecs);
+        if (written > capacity) {
+            return 0;
+        }
+        std::memcpy(buffer + sizeof(header), (const void*)this, sizeof(Ecs));
+
+        typedef std::uint64_t Word;
+        const Word* words = allocator.at<Word>(0);
+        const Word* baselineWords = baseline.allocator.at<Word>(0);
+        const u32 wordCount = std::min(used, baselineUsed) / sizeof(Word);
+        u32 i = 0;
+        u32 previousEnd = 0;
+        while (true) {
+            while (i < wordCount && words[i] == baselineWords[i]) {
+                ++i;
+            }
+            if (i == wordCount) {
+                break;
+            }
+
+            // Short stretches of unchanged words cost less than a new run
+            const u32 runStart = i;
+            u32 runEnd = i;
+            while (i < wordCount && i - runEnd < DeltaRunGap) {
+                if (words[i] != baselineWords[i]) {
+                    runEnd = i + 1;
+                }
+                ++i;
+            }
+            i = runEnd;
+
+            const DeltaRun run = {std::uint32_t(runStart - previousEnd),
+                                  std::uint32_t(runEnd - runStart)};
+            const u32 runSize = sizeof(run) + run.length * sizeof(Word);
+            if (written + runSize > capacity) {
+                return 0;
+            }
+            std::memcpy(buffer + written, &run, sizeof(run));
+            Word* out = (Word*)(buffer + written + sizeof(run));
+            for (u32 w = runStart; w < runEnd; ++w) {
+                out[w - runStart] = words[w] ^ baselineWords[w];
+            }
+            written += runSize;
+            previousEnd = runEnd;
+            ++header.runCount;
+        }
+
+        const u32 tailStart = wordCount * sizeof(Word);
+        const u32 tailSize = used > tailStart ? used - tailStart : 0;
+        if (written + tailSize > capacity) {
+            return 0;
+        }
+        std::memcpy(buffer + written, allocator.memory() + tailStart, tailSize);
+        written += tailSize;
+
+        std::memcpy(buffer, &header, sizeof(header));
+        return written;
+    }
+
+    /**
+    * @brief Brings this world from the baseline state of a delta to the
+    * state it was encoded from, @see encodeDelta()
+    * The arena keeps its memory, and ends bitwise equal to the encoder's.
+    *
+    * @return false, leaving the world untouched, if the delta was encoded
+    * for another baseline or doesn't fit in this world
+    */
+    bool applyDelta(const char* delta, u32 size)
+    {
+        DeltaHeader header;
+        if (size < sizeof(header) + sizeof(Ecs)) {
+            return false;
+        }
+        std::memcpy(&header, delta, sizeof(header));
+        if (header.worldSize != sizeof(Ecs) || header.baselineUsed != allocator.usedSize() ||
+            header.arenaUsed > allocator.size()) {
+            TECS_LOG_ERROR("Delta does not apply to this world!");
+            return false;
+        }
+
+        typedef std::uint64_t Word;
+        Word* words = allocator.at<Word>(0);
+        const u32 wordCount = std::min(header.arenaUsed, header.baselineUsed) / sizeof(Word);
+        // Runs are checked before changing anything, then applied
+        u32 read = 0;
+        for (int apply = 0; apply < 2; ++apply) {
+            read = sizeof(header) + sizeof(Ecs);
+            u32 position = 0;
+            for (u32 r = 0; r < header.runCount; ++r) {
+                DeltaRun run;
+                if (read + sizeof(run) > size) {
+                    return false;
+                }
+                std::memcpy(&run, delta + read, sizeof(run));
+                read += sizeof(run);
+                position += run.skip;
+                if (position + run.length > wordCount ||
+                    read + run.length * sizeof(Word) > size) {
+                    return false;
+                }
+                const Word* changes = (const Word*)(delta + read);
+                for (u32 w = 0; apply && w < run.length; ++w) {
+                    words[position + w] ^= changes[w];
+                }
+                read += run.length * sizeof(Word);
+                position += run.length;
+            }
+            const u32 tailStart = wordCount * sizeof(Word);
+            const u32 tailSize = header.arenaUsed > tailStart ? header.arenaUsed - tailStart : 0;
+            if (read + tailSize != size) {
+                return false;
+            }
+        }
+
+        const u32 tailStart = wordCount * sizeof(Word);
+        std::memcpy(allocator.memory() + tailStart, delta + read, size - read);
+
+        char* memory = allocator.memory();
+        const u32 memorySize = allocator.size();
+        std::memcpy((void*)this, delta + sizeof(header), sizeof(Ecs));
+        rebind(memory, memorySize);
+        markAllChanged();
+        return true;
+    }
+
+    /**
+    * @brief Starts recording entity creation and destruction, and added and
+    * removed components, in a journal buffer taken from the arena.
+    * Records are kept until flushJournal() writes them in one batch.
+    *
+    * Replaying a journal over a snapshot of the world taken when it started
+    * rebuilds the same entities and components. Component values are only
+    * part of it when recorded with journalWrite().
+    *
+    * @param size bytes of the journal buffer, must fit the records between
+    * flushes
+    */
+    void enableJournal(u32 size)
+    {
+        journal = allocator.allocOffset<char>(size);
+        journalSize = size;
+        journalUsed = 0;
+        journalRecordsLost = 0;
+    }
+
+    /**
+    * @brief Records the current value of a component in the journal.
+    */
+    template <typename T>
+    void journalWrite(EntityHandle entityHandle)
+    {
+        if (T* component = getComponent<T>(entityHandle)) {
+            appendJournal(JournalOp::WriteComponent, entityHandle.id,
+                          TypeProvider::template TypeId<T>(), sizeof(T), component);
+        }
+    }
+
+    /**
+    * @brief Appends the journal records to a file and empties the buffer.
+    * If records were lost, because the buffer was full or entities were
+    * created with newEntityConcurrent(), a RecordsLost record follows so
+    * replaying the file fails there instead of diverging.
+    *
+    * @return false if writing failed or records were lost
+    */
+    bool flushJournal(std::FILE* file)
+    {
+        bool written = std::fwrite(allocator.at<char>(journal), 1, journalUsed, file) == journalUsed;
+        const bool lost = journalRecordsLost != 0;
+        if (lost) {
+            const JournalRecord record = {JournalOp::RecordsLost, 0, 0, 0, 0};
+            written = written && std::fwrite(&record, sizeof(record), 1, file) == 1;
+        }
+        journalUsed = 0;
+        journalRecordsLost = 0;
+        return written && !lost;
+    }
+
+    /**
+    * @brief Applies the records of a journal file, @see enableJournal()
+    * The changes are not recorded again in this world journal.
+    *
+    * @return false if a record doesn't apply, meaning the world was not in
+    * the state the journal started from
+    */
+    bool replayJournal(std::FILE* file)
+    {
+        const ArenaOffset recording = journal;
+        journal = 0;
+        JournalRecord record;
+        bool applied = true;
+        while (applied && std::fread(&record, sizeof(record), 1, file) == 1) {
+            applied = replayRecord(record, file);
+        }
+        journal = recording;
+        return applied;
+    }
+
+    /**
+    * @brief Writes a component container as a columnar file, @see
+    * ColumnsHeader
+    * Dense chunks are streamed one after the other as row groups, skipping
+    * removed components. Without field descriptors the whole component is a
+    * single column, written straight from the dense chunks.
+    *
+    * @param <T> the component type
+    * @param fields the columns to export, @see TECS_FIELD()
+    * @param fieldCount amount of fields, 0 to export whole components
+    *
+    * @return false if the file could not be written
+    */
+    template <typename T>
+    bool exportColumns(std::FILE* file, const FieldDescriptor* fields = nullptr, u32 fieldCount = 0)
+    {
+        const FieldDescriptor component = {"component", 0, sizeof(T)};
+        if (fieldCount == 0) {
+            fields = &component;
+            fieldCount = 1;
+        }
+        return exportColumns(TypeProvider::template TypeId<T>(), file, fields, fieldCount);
+    }
+
+    /**
+    * @brief Writes a component container as a columnar file.
+    * @see exportColumns<T>()
+    *
+    * @param type the component type id (from TypeProvider)
+    */
+    bool exportColumns(u32 type, std::FILE* file, const FieldDescriptor* fields, u32 fieldCount)
+    {
+        const ComponentContainer& c = containers[type];
+        const ColumnsHeader header = {ColumnsMagic, ColumnsVersion,
+                                      (std::uint32_t)c.componentSize, (std::uint32_t)fieldCount,
+                                      (std::uint32_t)getComponentAmount(type)};
+        bool written = std::fwrite(&header, sizeof(header), 1, file) == 1;
+        for (u32 f = 0; f < fieldCount; ++f) {
+            ColumnDescriptor column = {{}, fields[f].offset, fields[f].size};
+            std::strncpy(column.name, fields[f].name, sizeof(column.name) - 1);
+            written = written && std::fwrite(&column, sizeof(column), 1, file) == 1;
+        }
+        if (c.componentSize == 0) {
+            return written;
+        }
+
+        for (u32 chunk = 0; written && chunk * c.chunkSize <= c.highestHandle; ++chunk) {
+            written = exportRowGroup(c, chunk, file, fields, fieldCount);
+        }
+        return written;
+    }
+
+    /**
+    * @brief Makes dst a copy of this world, using the memory of the given
+    * arena. Only the used extent of the arena is copied.
+    *
+    * @param dst world to overwrite
+    * @param arena memory for the copy, at least arena().usedSize() bytes
+    */
+    void cloneInto(Ecs& dst, ArenaAllocator arena) const
+    {
+        TECS_ASSERT(allocator.usedSize() <= arena.size(), "Clone does not fit in the arena!");
+        std::memcpy(arena.memory(), allocator.memory(), allocator.usedSize());
+        dst = *this;
+        dst.rebind(arena.memory(), arena.size());
+    }
+
+#ifdef TECS_HAS_MMAP
+    /**
+    * @brief Makes dst a copy-on-write fork of this world, which must be
+    * using the given memory for its arena.
+    * The fork maps the same memory privately: forking costs a mapping, and
+    * the fork only pays for the pages it writes to.
+    *
+    * This world must not change while the fork is in use, pages the fork
+    * didn't write to yet still show this world's memory.
+    *
+    * @return the mapping holding the fork memory, which must be kept alive
+    * while the fork is used. Converts to false if the mapping failed.
+    */
+    [[nodiscard]] SnapshotMapping forkInto(Ecs& dst, const ForkableMemory& memory) const
+    {
+        TECS_ASSERT(memory.data() == allocator.memory(), "World is not in the forkable memory!");
+        SnapshotMapping mapping;
+        if (mapping.mapPrivate(memory.file(), memory.size())) {
+            dst = *this;
+            dst.rebind(mapping.data(), memory.size());
+        }
+        return mapping;
+    }
+#endif
+
+    typedef std::array<ChunkMask, MaxComponents> ChangedChunks;
+
+    /**
+    * @brief Dense data chunks that might have been written since the last
+    * call, one mask per component type. Tracking starts over.
+    *
+    * Writes through the Ecs API are tracked: adding, getting, removing and
+    * sorting components, and forEach over a container. Writes through
+    * component references kept from before the last call must be reported
+    * with markChanged().
+    */
+    ChangedChunks takeChangedChunks()
+    {
+        ChangedChunks changed;
+        for (u32 type = 0; type < MaxComponents; ++type) {
+            changed[type] = containers[type].changedChunks;
+            containers[type].changedChunks = 0;
+        }
+        return changed;
+    }
+
+    /**
+    * @brief Reports writes to components of a type that the Ecs can't see
+    * @see takeChangedChunks()
+    */
+    template <typename T>
+    void markChanged()
+    {
+        containers[TypeProvider::template TypeId<T>()].changedChunks = AllChunks;
+    }
+
+    void markAllChanged()
+    {
+        for (ComponentContainer& c : containers) {
+            c.changedChunks = AllChunks;
+        }
+    }
+
+    /**
+    * @brief Like cloneInto(), but dst already is a copy of an earlier state
+    * of this world, and dense data chunks that didn't change since are left
+    * as they are. All other arena memory is copied.
+    *
+    * @param dst earlier clone of this world
+    * @param changed chunks written since dst was cloned, @see
+    * takeChangedChunks()
+    */
+    void cloneChangesInto(Ecs& dst, const ChangedChunks& changed) const
+    {
+        const u32 used = allocator.usedSize();
+        TECS_ASSERT(used <= dst.allocator.size(), "Clone does not fit in the arena!");
+        char* memory = dst.allocator.memory();
+        const u32 memorySize = dst.allocator.size();
+
+        // The unchanged chunks of each container are listed by arena
+        // position, as chunks given memory again after a region unload are
+        // not in chunk order, and merging the lists visits them all in
+        // order. Region chunks are always copied
+        std::array<std::array<std::uint8_t, MaxComponentChunks>, MaxComponents> skipped;
+        std::array<u32, MaxComponents> skippedCount = {};
+        for (u32 type = 0; type < MaxComponents; ++type) {
+            const ComponentContainer& c = containers[type];
+            if (c.componentSize == 0) {
+                continue;
+            }
+            const ArenaOffset* chunks = allocator.at<ArenaOffset>(c.denseData);
+            const ChunkMask copied = changed[type] | c.regionChunks;
+            std::uint8_t* list = skipped[type].data();
+            u32& count = skippedCount[type];
+            for (u32 chunk = 0; chunk < MaxComponentChunks; ++chunk) {
+                if (chunks[chunk] == 0 || (copied >> chunk) & 1) {
+                    continue;
+                }
+                u32 i = count++;
+                for (; i > 0 && chunks[list[i - 1]] > chunks[chunk]; --i) {
+                    list[i] = list[i - 1];
+                }
+                list[i] = std::uint8_t(chunk);
+            }
+        }
+
+        std::array<u32, MaxComponents> nextChunk = {};
+        u32 position = 0;
+        while (true) {
+            u32 skipType = MaxComponents;
+            ArenaOffset skipStart = used;
+            for (u32 type = 0; type < MaxComponents; ++type) {
+                if (nextChunk[type] == skippedCount[type]) {
+                    continue;
+                }
+                const ComponentContainer& c = containers[type];
+                const ArenaOffset start =
+                    allocator.at<ArenaOffset>(c.denseData)[skipped[type][nextChunk[type]]];
+                if (start < skipStart) {
+                    skipType = type;
+                    skipStart = start;
+                }
+            }
+
+            std::memcpy(memory + position, allocator.memory() + position, skipStart - position);
+            if (skipType == MaxComponents) {
+                break;
+            }
+            const ComponentContainer& c = containers[skipType];
+            position = skipStart + c.componentSize * c.chunkSize;
+            ++nextChunk[skipType];
+        }
+
+        dst = *this;
+        dst.rebind(memory, memorySize);
+    }
+
+    /**
+    * @brief Arena holding the whole world state.
+    * Everything in it is referenced by ArenaOffset instead of pointers, so
+    * a plain copy of this object plus the first arena().usedSize() bytes is
+    * a complete snapshot, valid at any address once given to rebind().
+    */
+    const ArenaAllocator& arena() const
+    {
+        return allocator;
+    }
+
+    /**
+    * @brief Moves the world to another memory, which must already contain
+    * a copy of the used bytes of the arena.
+    *
+    * @param memory new arena memory, at any address
+    * @param size new arena size, at least arena().usedSize()
+    */
+    void rebind(char* memory, u32 size)
+    {
+        allocator.rebase(memory, size);
+    }
+
+    template <typename T>
+    u32 buildComponentMask(T first)
+    {
+        return first;
+    }
+
+    template <typename T, typename... Args>
+    u32 buildComponentMask(T first, Args... args)
+    {
+        return first | buildComponentMask(args...);
+    }
+
+    template <typename... Args>
+    u32 buildComponentMask()
+    {
+        return buildComponentMask(TypeProvider::template TypeId<Args>()...);
+    }
+
+    
+private:
+    /**
+     * @brief Check if a given component handle is valid.
+     * DOES NOT MEAN IT IS ATTACHED TO AN ENTITY.
+     * Just that it is a valid handle id to be used internally.
+     *
+     * @param handle the component handle
+     *
+     * @return true if the component belongs to a live entity.
+     */
+    bool isComponentHandleValid(const ComponentContainer& c, ComponentHandle handle)
+    {
+        return handle > 0 && handle <= c.chunkSize * MaxComponentChunks;
+    }
+
+    static constexpr u32 SnapshotArenaAlignment = 64;
+    // Entities created at once, @see instantiate()
+    static constexpr u32 InstantiateBatch = 256;
+    // Dense entries visited between clock reads, @see forEachBudgeted()
+    static constexpr u32 BudgetTimeCheckInterval = 64;
+    // Unchanged words that end a delta run, @see encodeDelta()
+    static constexpr u32 DeltaRunGap = 4;
+
+    static constexpr std::uint32_t snapshotArenaOffset()
+    {
+        const u32 end = sizeof(SnapshotHeader) + sizeof(Ecs);
+        return (end + SnapshotArenaAlignment - 1) / SnapshotArenaAlignment *
+               SnapshotArenaAlignment;
+    }
+
+    /**
+     * @return true if the component type is unused or stored with this size
+     */
+    bool hasComponentSize(u32 typeId, u32 compSize) const
+    {
+        return containers[typeId].componentSize == 0 ||
+               containers[typeId].componentSize == compSize;
+    }
+
+    /**
+     * @brief Writes the live entries of a dense chunk, column by column.
+     * Columns covering whole components are written from the chunk in runs
+     * of consecutive entries, other columns are gathered, @see
+     * writeGathered()
+     */
+    bool exportRowGroup(const ComponentContainer& c,
+                        u32 chunk,
+                        std::FILE* file,
+                        const FieldDescriptor* fields,
+                        u32 fieldCount)
+    {
+        // Positions in the chunk, handle 0 is never used
+        const u32 first = chunk == 0 ? 1 : 0;
+        const u32 last = std::min(c.chunkSize - 1, c.highestHandle - chunk * c.chunkSize);
+        const EntityHandle* owners =
+            allocator.at<EntityHandle>(allocator.at<ArenaOffset>(c.denseEntities)[chunk]);
+        const char* data = allocator.at<char>(allocator.at<ArenaOffset>(c.denseData)[chunk]);
+
+        std::uint32_t rows = 0;
+        for (u32 handle = first; handle <= last; ++handle) {
+            rows += owners[handle].id != 0;
+        }
+        if (rows == 0) {
+            return true;
+        }
+        bool written = std::fwrite(&rows, sizeof(rows), 1, file) == 1;
+        written = written && writeGathered(file, owners, first, last, sizeof(std::uint32_t),
+                                           [&](char* out, u32 handle) {
+                                               const std::uint32_t id = owners[handle].id;
+                                               std::memcpy(out, &id, sizeof(id));
+                                           });
+
+        for (u32 f = 0; f < fieldCount; ++f) {
+            const FieldDescriptor& field = fields[f];
+            if (field.offset == 0 && field.size == c.componentSize) {
+                u32 handle = first;
+                while (handle <= last) {
+                    while (handle <= last && owners[handle].id == 0) {
+                        ++handle;
+                    }
+                    const u32 runStart = handle;
+                    while (handle <= last && owners[handle].id != 0) {
+                        ++handle;
+                    }
+                    const u32 runSize = (handle - runStart) * c.componentSize;
+                    written = written && std::fwrite(data + runStart * c.componentSize, 1,
+                                                     runSize, file) == runSize;
+                }
+                continue;
+            }
+
+            const char* values = data + field.offset;
+            const u32 stride = c.componentSize;
+            // Common field sizes get an inlined copy
+            if (field.size == 4) {
+                written = written && writeGathered(file, owners, first, last, 4,
+                                                   [&](char* out, u32 handle) {
+                                                       std::memcpy(out, values + handle * stride, 4);
+                                                   });
+            }
+            else if (field.size == 8) {
+                written = written && writeGathered(file, owners, first, last, 8,
+                                                   [&](char* out, u32 handle) {
+                                                       std::memcpy(out, values + handle * stride, 8);
+                                                   });
+            }
+            else {
+                written = written && writeGathered(file, owners, first, last, field.size,
+                                                   [&](char* out, u32 handle) {
+                                                       std::memcpy(out, values + handle * stride,
+                                                                   field.size);
+                                                   });
+            }
+        }
+        return written;
+    }
+
+    /**
+     * @brief Writes a value of each live entry of a dense chunk, gathered
+     * in a small buffer.
+     *
+     * @param copy void(char* out, u32 position) writes the value of the
+     * entry at a chunk position
+     */
+    template <typename Copy>
+    bool writeGathered(std::FILE* file,
+                       const EntityHandle* owners,
+                       u32 first,
+                       u32 last,
+                       u32 size,
+                       Copy copy)
+    {
+        char buffer[4096];
+        TECS_ASSERT(size <= sizeof(buffer), "Field too big to export!");
+        u32 buffered = 0;
+        bool written = true;
+        for (u32 handle = first; handle <= last; ++handle) {
+            if (owners[handle].id != 0) {
+                if (buffered + size > sizeof(buffer)) {
+                    written = written && std::fwrite(buffer, 1, buffered, file) == buffered;
+                    buffered = 0;
+                }
+                copy(buffer + buffered, handle);
+                buffered += size;
+            }
+        }
+        return written && std::fwrite(buffer, 1, buffered, file) == buffered;
+    }
+
+    void appendJournal(JournalOp op,
+                       u32 entity,
+                       u32 type = 0,
+                       u32 size = 0,
+                       const void* data = nullptr)
+    {
+        if (journal == 0) {
+            return;
+        }
+        const u32 dataSize = data != nullptr ? size : 0;
+        if (journalUsed + sizeof(JournalRecord) + dataSize > journalSize) {
+            TECS_LOG_ERROR("Journal is full, flush it more often!");
+            journalRecordsLost = 1;
+            return;
+        }
+        const JournalRecord record = {op, (std::uint8_t)type, 0, (std::uint32_t)entity,
+                                      (std::uint32_t)size};
+        char* end = allocator.at<char>(journal) + journalUsed;
+        std::memcpy(end, &record, sizeof(record));
+        if (dataSize > 0) {
+            std::memcpy(end + sizeof(record), data, dataSize);
+        }
+        journalUsed += sizeof(record) + dataSize;
+    }
+
+    bool replayRecord(const JournalRecord& record, std::FILE* file)
+    {
+        if (record.op == JournalOp::RecordsLost) {
+            return false;
+        }
+        if (record.entity == 0 || record.entity > maxEntities) {
+            return false;
+        }
+        // The type of region records is the region
+        if (record.op == JournalOp::NewEntity) {
+            return record.type <= regionCount && newEntity(record.type).id == record.entity;
+        }
+        if (record.op == JournalOp::UnloadRegion) {
+            if (record.type == 0 || record.type > regionCount ||
+                regions[record.type - 1].firstEntity != record.entity) {
+                return false;
+            }
+            unloadRegion(record.type);
+            return true;
+        }
+        if (record.type >= MaxComponents) {
+            return false;
+        }
+
+        const EntityHandle handle = entityArray()[record.entity].handle;
+        if (!isEntityAlive(handle)) {
+            return false;
+        }
+        switch (record.op) {
+        case JournalOp::DestroyEntity:
+            destroyExistingEntity(handle);
+            return true;
+        case JournalOp::AddComponent:
+            addComponent(handle, record.type, record.size);
+            return true;
+        case JournalOp::RemoveComponent:
+            removeComponentOfExistingEntity(handle, record.type);
+            return true;
+        case JournalOp::WriteComponent: {
+            void* component = addComponent(handle, record.type, record.size);
+            return std::fread(component, record.size, 1, file) == 1;
+        }
+        case JournalOp::DisableEntity:
+        case JournalOp::EnableEntity:
+            setEntityEnabled(handle, record.op == JournalOp::EnableEntity);
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /**
+     * @brief Pushes a dead entity on the free list, its handle id links to
+     * the next free one.
+     */
+    void pushFreeEntity(u32 id)
+    {
+        if (isDisabled(id)) {
+            disabledEntities.clear(allocator, id);
+            --disabledCount;
+        }
+        Entity& e = entityArray()[id];
+        e.handle.alive = 0;
+        if (const RegionHandle region = entityRegion(id)) {
+            // Region ids must stay in the region
+            Region& r = regions[region - 1];
+            e.handle.id = r.freeEntities;
+            r.freeEntities = id;
+            return;
+        }
+        e.handle.id = std::uint32_t(freeEntities);
+        freeEntities = ((freeEntities & FreeEntitiesTagMask) + FreeEntitiesTagOne) | id;
+    }
+
+    /**
+     * @return the region whose ids contain the entity, 0 for none
+     */
+    RegionHandle entityRegion(u32 id) const
+    {
+        if (regionPages == 0) {
+            return 0;
+        }
+        return allocator.at<std::uint8_t>(regionPages)[id / ComponentContainer().idChunkSize];
+    }
+
+    // Aligned like arena allocations, @see ArenaAllocator::allocOffset()
+    ArenaOffset allocRegionMemory(Region& r, u32 size)
+    {
+        const std::uint64_t start = (std::uint64_t(r.used) + 7) & ~std::uint64_t(7);
+        if (start + size > r.size) {
+            TECS_LOG_ERROR("Region overflow!");
+            throw("Region overflow");
+        }
+        r.used = u32(start + size);
+        return r.memory + ArenaOffset(start);
+    }
+
+    /**
+     * @brief Takes the next dense entry of the chunks the region owns in
+     * the container, claiming a new chunk when they are full.
+     */
+    ComponentHandle regionComponentHandle(ComponentContainer& c, u32 type, RegionHandle region)
+    {
+        Region& r = regions[region - 1];
+        RegionContainer& owned = allocator.at<RegionContainer>(r.containers)[type];
+        if (owned.next == 0) {
+            claimRegionChunk(c, r, owned);
+        }
+        const ComponentHandle handle = owned.next++;
+        if (owned.next % c.chunkSize == 0) {
+            owned.next = 0;
+        }
+        return handle;
+    }
+
+    /**
+     * @brief Gives a dense chunk to a region: one dropped by an unloaded
+     * region, or else the one above the dense storage. The world never
+     * takes entries from region chunks as they are always below its
+     * highest handle and out of its free list.
+     */
+    void claimRegionChunk(ComponentContainer& c, Region& r, RegionContainer& owned)
+    {
+        ArenaOffset* data = allocator.at<ArenaOffset>(c.denseData);
+        ArenaOffset* owners = allocator.at<ArenaOffset>(c.denseEntities);
+        u32 chunk;
+        if (c.droppedChunks != 0) {
+            chunk = countTrailingZeros(c.droppedChunks);
+            c.droppedChunks &= ~(ChunkMask(1) << chunk);
+        }
+        else {
+            const ComponentHandle next = c.highestHandle + 1;
+            chunk = next / c.chunkSize;
+            TECS_ASSERT(chunk < MaxComponentChunks, "no enough space!");
+            if (data[chunk] != 0) {
+                // The rest of the partly used chunk becomes free entries
+                for (ComponentHandle handle = next; handle < (chunk + 1) * c.chunkSize; ++handle) {
+                    replaceDenseComponentFreeIndex(c, handle);
+                }
+                ++chunk;
+                TECS_ASSERT(chunk < MaxComponentChunks, "no enough space!");
+            }
+            c.highestHandle = (chunk + 1) * c.chunkSize - 1;
+        }
+
+        data[chunk] = allocRegionMemory(r, c.componentSize * c.chunkSize);
+        owners[chunk] = allocRegionMemory(r, sizeof(EntityHandle) * c.chunkSize);
+        std::memset(allocator.at<EntityHandle>(owners[chunk]), 0, sizeof(EntityHandle) * c.chunkSize);
+        const ChunkMask bit = ChunkMask(1) << chunk;
+        c.regionChunks |= bit;
+        c.changedChunks |= bit;
+        owned.chunks |= bit;
+        // Handle 0 is never used
+        owned.next = std::max(chunk * c.chunkSize, u32(1));
+    }
+
+    /**
+     * @brief Releases the chunks of an unloaded region. They keep an empty
+     * owners chunk until reused, so dense walks see them as holes, and the
+     * ones at the top are given back to the dense storage.
+     */
+    void dropRegionChunks(ComponentContainer& c, ChunkMask chunks)
+    {
+        ArenaOffset* data = allocator.at<ArenaOffset>(c.denseData);
+        ArenaOffset* owners = allocator.at<ArenaOffset>(c.denseEntities);
+        for (ChunkMask remaining = chunks; remaining != 0; remaining &= remaining - 1) {
+            const u32 chunk = countTrailingZeros(remaining);
+            const EntityHandle* entries = allocator.at<EntityHandle>(owners[chunk]);
+            for (u32 i = 0; i < c.chunkSize; ++i) {
+                c.aliveComponents -= entries[i].id != 0;
+            }
+            data[chunk] = 0;
+            owners[chunk] = emptyDenseChunk;
+        }
+        c.regionChunks &= ~chunks;
+        c.droppedChunks |= chunks;
+        c.changedChunks |= chunks;
+
+        while (c.highestHandle > 0 && (c.droppedChunks >> (c.highestHandle / c.chunkSize)) & 1) {
+            const u32 chunk = c.highestHandle / c.chunkSize;
+            owners[chunk] = 0;
+            c.droppedChunks &= ~(ChunkMask(1) << chunk);
+            c.highestHandle = chunk == 0 ? 0 : chunk * c.chunkSize - 1;
+        }
+    }
+
+    static_assert(sizeof(EntityHandle) == sizeof(std::uint64_t),
+                  "Entity handles are updated as one word!");
+    EntityHandle loadEntityHandle(u32 id) const
+    {
+        const std::uint64_t word = atomicLoad((const std::uint64_t*)&entityArray()[id].handle);
+        return *(const EntityHandle*)&word;
+    }
+
+    void storeEntityHandle(u32 id, EntityHandle handle)
+    {
+        atomicStore((std::uint64_t*)&entityArray()[id].handle, *(const std::uint64_t*)&handle);
+    }
+
+    /**
+     * @return true if the entity had the component
+     */
+    bool eraseComponent(EntityHandle entityHandle, u32 componentType)
+    {
+        ComponentContainer& c = containers[componentType];
+        if (c.componentSize == 0) {
+            // Component not in use
+            return false;
+        }
+
+        const u32 sparseEntityIdx = entityHandle.id / c.idChunkSize;
+        const u32 denseEntityIdx = entityHandle.id % c.idChunkSize;
+        u32* sparsePage = sparseIdPage(c, sparseEntityIdx);
+        if (sparsePage == nullptr) {
+            // Entity didnt have the component
+            return false;
+        }
+        else {
+            u32 possibleHandle = sparsePage[denseEntityIdx];
+            if (isComponentHandleValid(c, possibleHandle)) {
+                replaceDenseComponentFreeIndex(c, possibleHandle);
+                sparsePage[denseEntityIdx] = 0;
+                c.entityBits.clear(allocator, entityHandle.id);
+                --c.aliveComponents;
+                return true;
+            }
+            else {
+                // Entity didnt have the component
+                return false;
+            }
+        }
+    }
+
+    ComponentContainer& ensureComponentContainer(u32 typeId, u32 compSize)
+    {
+        TECS_ASSERT(
+            compSize >= sizeof(ChunkEmptyEntry),
+            "Compsize must be at least size of ChunkEmptyEntry (4 bytes)");
+        ComponentContainer& c = containers[typeId];
+        TECS_ASSERT(hasComponentSize(typeId, compSize),
+                    "Component type registered with another size!");
+        if (c.componentSize == 0) {
+            c.componentSize = compSize;
+            // Make sure to include all possible entries
+            // with +1 to round up
+            c.chunkSize = (maxEntities / MaxComponentChunks) + 1;
+            u32 size = (maxEntities / c.idChunkSize) + 1;
+            c.sparseIds = allocator.allocOffset<ArenaOffset>(size);
+            c.denseData = allocator.allocOffset<ArenaOffset>(MaxComponentChunks);
+            c.denseEntities = allocator.allocOffset<ArenaOffset>(MaxComponentChunks);
+            std::memset(allocator.at<ArenaOffset>(c.sparseIds), 0, sizeof(ArenaOffset) * size);
+            std::memset(allocator.at<ArenaOffset>(c.denseData), 0,
+                        sizeof(ArenaOffset) * MaxComponentChunks);
+            std::memset(allocator.at<ArenaOffset>(c.denseEntities), 0,
+                        sizeof(ArenaOffset) * MaxComponentChunks);
+
+            initEntityBitset(c.entityBits);
+        }
+        return c;
+    }
+
+    void initEntityBitset(EntityBitset& bits)
+    {
+        // Bitset entity words are allocated in whole blocks, so block
+        // intersection never needs to check bounds
+        const u32 entityWordCount = maxEntities / BitsPerWord + 1;
+        bits.blockWordCount = entityWordCount / BitsPerWord + 1;
+        const u32 blockedWordCount = bits.blockWordCount * BitsPerWord;
+        bits.entityWords = allocator.allocOffset<BitsetWord>(blockedWordCount);
+        bits.blockWords = allocator.allocOffset<BitsetWord>(bits.blockWordCount);
+        bits.occupiedBlocks = 0;
+        std::memset(allocator.at<BitsetWord>(bits.entityWords), 0, sizeof(BitsetWord) * blockedWordCount);
+        std::memset(allocator.at<BitsetWord>(bits.blockWords), 0, sizeof(BitsetWord) * bits.blockWordCount);
+    }
+
+    inline EntityHandle& denseEntity(tecs::ComponentContainer& c, const u32 entity) {
+        const ArenaOffset chunk = allocator.at<ArenaOffset>(c.denseEntities)[entity / c.chunkSize];
+        return allocator.at<EntityHandle>(chunk)[entity % c.chunkSize];
+    }
+
+    void* accessComponentData(tecs::ComponentContainer& c, const u32 componentHandle)
+    {
+        TECS_ASSERT(componentHandle <= c.chunkSize * MaxComponentChunks, "no enough space!");
+        u32 compSparse = componentHandle / c.chunkSize;
+        markChunkChanged(c, componentHandle);
+        ArenaOffset& dataChunk = allocator.at<ArenaOffset>(c.denseData)[compSparse];
+        if (dataChunk == 0) {
+            // Allocate dense data chunk
+            const u32 chunkDataSize = c.componentSize * c.chunkSize;
+            dataChunk = allocator.allocOffset<char>(chunkDataSize);
+            allocator.at<ArenaOffset>(c.denseEntities)[compSparse] =
+                allocator.allocOffset<EntityHandle>(c.chunkSize);
+            return allocator.at<char>(dataChunk) + (componentHandle % c.chunkSize) * c.componentSize;
+        }
+        else {
+            return allocator.at<char>(dataChunk) + (componentHandle % c.chunkSize) * c.componentSize;
+        }
+    }
+
+    /**
+     * @brief Marks the dense chunk of a handle as changed. Only writes if
+     * unmarked, as systems can access the same container concurrently.
+     */
+    void markChunkChanged(ComponentContainer& c, ComponentHandle handle)
+    {
+        const ChunkMask bit = ChunkMask(1) << (handle / c.chunkSize);
+        if ((atomicLoad(&c.changedChunks) & bit) == 0) {
+            atomicFetchOr(&c.changedChunks, bit);
+        }
+    }
+
+    void pushDenseEntity(ComponentContainer& c, ComponentHandle handle, EntityHandle entity)
+    {
+        ++c.aliveComponents;
+        denseEntity(c, handle) = entity;
+        c.entityBits.set(allocator, entity.id);
+
+        // Appending increasing entity ids keeps the dense storage sorted
+        const bool appended = handle == c.highestHandle && entity.id > c.highestEntity;
+        c.sortedByEntity = c.sortedByEntity && appended;
+        c.highestEntity = entity.id > c.highestEntity ? entity.id : c.highestEntity;
+    }
+
+    inline Entity* entityArray() const
+    {
+        return allocator.at<Entity>(entities);
+    }
+
+    /**
+     * @return the sparse ids page, null if no entity in it has the component
+     */
+    inline u32* sparseIdPage(const ComponentContainer& c, const u32 page) const
+    {
+        const ArenaOffset offset = allocator.at<ArenaOffset>(c.sparseIds)[page];
+        return offset == 0 ? nullptr : allocator.at<u32>(offset);
+    }
+
+    inline ComponentHandle& sparseId(const ComponentContainer& c, const u32 entity)
+    {
+        const ArenaOffset page = allocator.at<ArenaOffset>(c.sparseIds)[entity / c.idChunkSize];
+        return allocator.at<u32>(page)[entity % c.idChunkSize];
+    }
+
+    inline char* denseComponent(const ComponentContainer& c, const ComponentHandle handle) const
+    {
+        const ArenaOffset chunk = allocator.at<ArenaOffset>(c.denseData)[handle / c.chunkSize];
+        return allocator.at<char>(chunk) + (handle % c.chunkSize) * c.componentSize;
+    }
+
+    template <typename... Components, typename F>
+    void runQuery(const QueryPlan<sizeof...(Components)>& plan, F& f)
+    {
+        if (plan.strategy == QueryStrategy::BitsetIntersection) {
+            forEachBitsetIntersection<Components...>(f);
+        }
+        else if (plan.strategy == QueryStrategy::MergeJoin) {
+            forEachMergeJoin<Components...>(f);
+        }
+        else if (plan.strategy == QueryStrategy::PrefetchedProbeJoin) {
+            forEachPrefetchedProbeJoin<Components...>(plan, f);
+        }
+        else {
+            forEachProbeJoin<Components...>(plan, f);
+        }
+    }
+
+    inline bool isDisabled(u32 entity) const
+    {
+        return disabledCount > 0 && disabledEntities.test(allocator, entity);
+    }
+
+    /**
+     * @brief Creates copies of entities in dst, which may be this world.
+     * Every batch of entities takes one pass per container.
+     */
+    void copyEntities(Ecs& dst, const EntityHandle* entities, u32 count, EntityHandle* out)
+    {
+        EntityHandle owners[InstantiateBatch];
+        const char* sources[InstantiateBatch];
+        for (u32 done = 0; done < count; done += InstantiateBatch) {
+            const u32 batchCount = std::min(count - done, InstantiateBatch);
+            const EntityHandle* batch = entities + done;
+            EntityHandle* copies = out + done;
+            for (u32 i = 0; i < batchCount; ++i) {
+                TECS_ASSERT(isEntityHandleValid(batch[i]), "Bad entity handle");
+                copies[i] = dst.newEntity();
+            }
+
+            for (u32 type = 0; type < MaxComponents; ++type) {
+                const ComponentContainer& c = containers[type];
+                if (c.componentSize == 0 || c.aliveComponents == 0) {
+                    continue;
+                }
+                u32 found = 0;
+                for (u32 i = 0; i < batchCount; ++i) {
+                    const ComponentHandle handle = getExistingEntityComponentHandle(batch[i].id, type);
+                    if (handle > 0) {
+                        owners[found] = copies[i];
+                        sources[found++] = denseComponent(c, handle);
+                    }
+                }
+                if (found == 0) {
+                    continue;
+                }
+                // Appending never moves the sources, even in the same container
+                const u32 size = c.componentSize;
+                ComponentContainer& target = dst.ensureComponentContainer(type, size);
+                dst.appendComponents(target, owners, found, [&](u32 first, u32 run, char* destination) {
+                    for (u32 j = 0; j < run; ++j) {
+                        std::memcpy(destination + j * size, sources[first + j], size);
+                    }
+                });
+                for (u32 i = 0; i < found; ++i) {
+                    dst.appendJournal(JournalOp::AddComponent, owners[i].id, type, size);
+                }
+            }
+            for (u32 i = 0; i < batchCount; ++i) {
+                if (isDisabled(batch[i].id)) {
+                    dst.setEntityEnabled(copies[i], false);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Appends a component for each of the entities, which must not
+     * have it yet, after the highest dense entry.
+     *
+     * @param fill called as (first, run, destination) to write the data of
+     * the components of entities[first] to entities[first + run - 1]
+     */
+    template <typename Fill>
+    void appendComponents(ComponentContainer& c, const EntityHandle* entities, u32 count, Fill fill)
+    {
+        const ComponentHandle first = c.highestHandle + 1;
+        TECS_ASSERT(c.highestHandle + count <= c.chunkSize * MaxComponentChunks, "no enough space!");
+        for (u32 i = 0; i < count;) {
+            const ComponentHandle handle = first + i;
+            const u32 run = std::min(count - i, c.chunkSize - handle % c.chunkSize);
+            fill(i, run, (char*)accessComponentData(c, handle));
+            std::memcpy(&denseEntity(c, handle), entities + i, sizeof(EntityHandle) * run);
+            i += run;
+        }
+
+        // New entities often share sparse pages, check them once each
+        u32 page = ~u32(0);
+        u32* sparsePage = nullptr;
+        for (u32 i = 0; i < count; ++i) {
+            const u32 entity = entities[i].id;
+            if (entity / c.idChunkSize != page) {
+                page = entity / c.idChunkSize;
+                ArenaOffset& offset = allocator.at<ArenaOffset>(c.sparseIds)[page];
+                if (offset == 0) {
+                    offset = allocator.allocOffset<u32>(c.idChunkSize);
+                    std::memset(allocator.at<u32>(offset), 0, sizeof(u32) * c.idChunkSize);
+                }
+                sparsePage = allocator.at<u32>(offset);
+            }
+            sparsePage[entity % c.idChunkSize] = first + i;
+            c.entityBits.set(allocator, entity);
+            c.sortedByEntity = c.sortedByEntity && entity > c.highestEntity;
+            c.highestEntity = std::max(c.highestEntity, u32(entity));
+        }
+        c.highestHandle += count;
+        c.aliveComponents += count;
+    }
+
+    /**
+     * @brief Fills count consecutive components with copies of one, doubling
+     * the copied range each step.
+     */
+    static void fillCopies(char* destination, const char* component, u32 size, u32 count)
+    {
+        std::memcpy(destination, component, size);
+        u32 filled = 1;
+        while (filled < count) {
+            const u32 copies = std::min(filled, count - filled);
+            std::memcpy(destination + filled * size, destination, copies * size);
+            filled += copies;
+        }
+    }
+
+    /**
+     * @brief Calls f for the entity of a dense entry of Driver if it has
+     * all the other components.
+     *
+     * @return true if f was called
+     */
+    template <typename Driver, typename... Components, typename F>
+    inline bool visitDenseEntry(const DenseCursor& dense, F& f)
+    {
+        const u32 entity = dense.entity->id;
+        if (!isDisabled(entity) &&
+            ((getExistingEntityComponentHandle(entity, TypeProvider::template TypeId<Components>()) > 0) && ...)) {
+            f(entityArray()[entity].handle, *(Driver*)dense.data, *iteratedComponent<Components>(entity)...);
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Same as accessExistingComponentData(), without marking the
+     * chunk changed. forEach marks its whole containers up front.
+     */
+    template <typename T>
+    inline T* iteratedComponent(u32 entity)
+    {
+        const ComponentContainer& c = containers[TypeProvider::template TypeId<T>()];
+        return (T*)denseComponent(c, sparseId(c, entity));
+    }
+
+    /**
+     * @brief Swaps the dense data and owners of two component handles.
+     * Does not update the sparse ids.
+     */
+    void swapDenseEntries(ComponentContainer& c, ComponentHandle a, ComponentHandle b)
+    {
+        EntityHandle entity = denseEntity(c, a);
+        denseEntity(c, a) = denseEntity(c, b);
+        denseEntity(c, b) = entity;
+
+        c.changedChunks |= (ChunkMask(1) << (a / c.chunkSize)) | (ChunkMask(1) << (b / c.chunkSize));
+        char* dataA = denseComponent(c, a);
+        char* dataB = denseComponent(c, b);
+        char buffer[64];
+        for (u32 offset = 0; offset < c.componentSize; offset += sizeof(buffer)) {
+            const u32 size = c.componentSize - offset < sizeof(buffer)
+                                 ? c.componentSize - offset
+                                 : sizeof(buffer);
+            std::memcpy(buffer, dataA + offset, size);
+            std::memcpy(dataA + offset, dataB + offset, size);
+            std::memcpy(dataB + offset, buffer, size);
+        }
+    }
+
+    /**
+     * @brief Moves an entity component to the given handle, the entry that
+     * was there takes its place. Positions before the target are not touched
+     * so placing entities one after the other applies any order in place.
+     */
+    void moveDenseEntry(ComponentContainer& c, u32 entity, ComponentHandle target)
+    {
+        const ComponentHandle current = sparseId(c, entity);
+        if (current != target) {
+            swapDenseEntries(c, current, target);
+            const u32 displaced = denseEntity(c, current).id;
+            if (displaced > 0) {
+                sparseId(c, displaced) = current;
+            }
+            sparseId(c, entity) = target;
+        }
+    }
+
+    /**
+     * @brief Orders a container like another one: entities present in both
+     * come first, in the same relative order, followed by the rest.
+     */
+    bool alignDenseStorage(ComponentContainer& reference, ComponentContainer& c)
+    {
+        if (c.componentSize == 0) {
+            return true;
+        }
+        if (!prepareSorting(c)) {
+            return false;
+        }
+
+        ComponentHandle target = 1;
+        DenseCursor cursor = {&reference, &allocator};
+        cursor.seek(0);
+        while (cursor.next()) {
+            if (c.entityBits.test(allocator, cursor.entity->id)) {
+                moveDenseEntry(c, cursor.entity->id, target++);
+            }
+        }
+        // Whatever is left keeps its order, packed after the aligned ones
+        for (ComponentHandle handle = target; handle <= c.highestHandle; ++handle) {
+            const u32 entity = denseEntity(c, handle).id;
+            if (entity > 0) {
+                moveDenseEntry(c, entity, target++);
+            }
+        }
+        compactDenseStorage(c);
+        c.sortedByEntity = c.aliveComponents <= 1;
+        return true;
+    }
+
+    /**
+     * @brief Sorting moves entries anywhere in the dense storage, so it is
+     * refused while regions own chunks of the container. Chunks dropped by
+     * unloaded regions are given memory from the arena so entries can be
+     * moved into them.
+     */
+    bool prepareSorting(ComponentContainer& c)
+    {
+        if (c.regionChunks != 0) {
+            TECS_LOG_ERROR("Can't sort a container with region chunks!");
+            return false;
+        }
+        ArenaOffset* data = allocator.at<ArenaOffset>(c.denseData);
+        ArenaOffset* owners = allocator.at<ArenaOffset>(c.denseEntities);
+        for (ChunkMask dropped = c.droppedChunks; dropped != 0; dropped &= dropped - 1) {
+            const u32 chunk = countTrailingZeros(dropped);
+            data[chunk] = allocator.allocOffset<char>(c.componentSize * c.chunkSize);
+            owners[chunk] = allocator.allocOffset<EntityHandle>(c.chunkSize);
+            std::memset(allocator.at<EntityHandle>(owners[chunk]), 0, sizeof(EntityHandle) * c.chunkSize);
+        }
+        c.droppedChunks = 0;
+        return true;
+    }
+
+    /**
+     * @brief Drops the holes once all live components were placed at the
+     * beginning of the dense storage.
+     */
+    void compactDenseStorage(ComponentContainer& c)
+    {
+        c.highestHandle = c.aliveComponents;
+        c.freeComponentHandle.nextFree = 0;
+        c.highestEntity = c.aliveComponents > 0 ? denseEntity(c, c.aliveComponents).id : 0;
+    }
+
+    /**
+     * @brief Walks the dense entities of the driving container and probes
+     * the sparse ids of the other containers, in the plan order.
+     */
+    template <typename... Components, typename F>
+    void forEachProbeJoin(const QueryPlan<sizeof...(Components)>& plan, F& f)
+    {
+        constexpr u32 probes = sizeof...(Components) - 1;
+        ComponentContainer& c = containers[plan.drivingType];
+
+        for (u32 i = 1; i <= c.highestHandle; ++i) {
+            u32 entity = denseEntity(c, i).id;
+            if (entity > 0) {
+                bool skip = false;
+                for (u32 j = 0; j < probes; ++j) {
+                    if (getExistingEntityComponentHandle(entity, plan.probeTypes[j]) == 0) {
+                        skip = true;
+                        break;
+                    }
+                }
+                if (skip) {
+                    continue;
                 }
+
+                Entity& e = entityArray()[entity];
+                f(e.handle, *iteratedComponent<Components>(entity)...);
             }
         }
-        // TODO: Change this to use reserved space from component 0
-        // This can be used to check if the user is using a bad component
-        // doing some memory checking.
-        // for now throws
-        throw("Bad entity handle");
     }
 
     /**
-     * @brief Get a component from an entity. 
-     *
-     * @param <T> the componen type
-     * @param entityHandle the entity to add a component
-     *
-     * @return null if not found. Valid pointer otherwise.
-     *
-    */
-    template <typename T>
-    T* getComponent(EntityHandle entityHandle)
+     * @brief ANDs the occupancy bitsets of all containers, skipping blocks
+     * where any of them is empty, and resolves the components of the
+     * remaining entities.
+     */
+    template <typename... Components, typename F>
+    void forEachBitsetIntersection(F& f)
     {
-        static_assert(sizeof(T) >= sizeof(ChunkEmptyEntry));
-        if (isEntityHandleValid(entityHandle)) {
-            u32 compTypeId = TypeProvider::template TypeId<T>();
+        constexpr u32 count = sizeof...(Components);
+        const BitsetWord* bitsets[] = {allocator.at<BitsetWord>(
+            containers[TypeProvider::template TypeId<Components>()].entityBits.entityWords)...};
+        const BitsetWord* summaries[] = {allocator.at<BitsetWord>(
+            containers[TypeProvider::template TypeId<Components>()].entityBits.blockWords)...};
+        const u32 blockCounts[] = {
+            containers[TypeProvider::template TypeId<Components>()].entityBits.blockWordCount...};
+        // Every bitset spans maxEntities, so they share the block count
+        const u32 blockCount = blockCounts[0];
 
-            ComponentContainer& c = ensureComponentContainer(compTypeId, sizeof(T));
+        BitsetWord words[BitsPerWord];
+        for (u32 block = 0; block < blockCount; ++block) {
+            BitsetWord summary = summaries[0][block];
+            for (u32 b = 1; b < count; ++b) {
+                summary &= summaries[b][block];
+            }
+            if (summary == 0) {
+                continue;
+            }
 
-            const u32 idContainer = entityHandle.id / c.idChunkSize;
-            const u32 denseEntityIdx = entityHandle.id % c.idChunkSize;
-            if (c.sparseIds[idContainer] == nullptr) {
-                return nullptr;
+            const u32 firstWord = block * BitsPerWord;
+            intersectBitsetBlock(bitsets, count, firstWord, words);
+            for (u32 w = 0; w < BitsPerWord; ++w) {
+                BitsetWord bits = words[w];
+                while (bits != 0) {
+                    const u32 entity = (firstWord + w) * BitsPerWord + countTrailingZeros(bits);
+                    bits &= bits - 1;
+
+                    Entity& e = entityArray()[entity];
+                    f(e.handle, *iteratedComponent<Components>(entity)...);
+                }
             }
-            else {
-                u32 possibleHandle = c.sparseIds[idContainer][denseEntityIdx];
-                if (isComponentHandleValid(possibleHandle)) {
-                    // Entity already contains the component
-                    return (T*)accessComponentData(c, possibleHandle);
+        }
+    }
+
+    template <typename... Components, typename F, std::size_t... Index>
+    void invokeWithComponents(F& f,
+                              EntityHandle handle,
+                              char* const* components,
+                              std::index_sequence<Index...>)
+    {
+        f(handle, *(Components*)components[Index]...);
+    }
+
+    /**
+     * @brief Probe join pipelined over a window of upcoming entities.
+     * Entities enter the window with their sparse ids prefetched, half a
+     * window later their handles are read and components prefetched, and
+     * only at the end of the window the callback is invoked.
+     * The driving container is walked with a DenseCursor.
+     */
+    template <typename... Components, typename F>
+    void forEachPrefetchedProbeJoin(const QueryPlan<sizeof...(Components)>& plan, F& f)
+    {
+        constexpr u32 count = sizeof...(Components);
+        ComponentContainer* cs[] = {&containers[TypeProvider::template TypeId<Components>()]...};
+        u32 driver = 0;
+        while (cs[driver] != &containers[plan.drivingType]) {
+            ++driver;
+        }
+
+        struct Slot {
+            u32 entity;
+            char* components[count];
+        };
+        constexpr u32 Window = PrefetchDistance * 2;
+        Slot slots[Window];
+        u32 filled = 0;
+        u32 resolved = 0;
+        u32 consumed = 0;
+
+        DenseCursor cursor = {cs[driver], &allocator};
+        cursor.seek(0);
+        bool more = true;
+        for (;;) {
+            while (more && filled - consumed < Window) {
+                more = cursor.next();
+                if (more) {
+                    Slot& slot = slots[filled % Window];
+                    slot.entity = cursor.entity->id;
+                    slot.components[driver] = cursor.data;
+                    for (u32 j = 0; j < count; ++j) {
+                        if (j != driver) {
+                            u32* sparsePage = sparseIdPage(*cs[j], slot.entity / cs[j]->idChunkSize);
+                            if (sparsePage != nullptr) {
+                                TECS_PREFETCH(sparsePage + slot.entity % cs[j]->idChunkSize);
+                            }
+                        }
+                    }
+                    ++filled;
                 }
             }
+
+            while (resolved < filled && resolved - consumed < PrefetchDistance) {
+                Slot& slot = slots[resolved % Window];
+                for (u32 j = 0; j < count; ++j) {
+                    if (j != driver) {
+                        u32* sparsePage = sparseIdPage(*cs[j], slot.entity / cs[j]->idChunkSize);
+                        const ComponentHandle handle =
+                            sparsePage ? sparsePage[slot.entity % cs[j]->idChunkSize] : 0;
+                        slot.components[j] = handle ? denseComponent(*cs[j], handle) : nullptr;
+                        TECS_PREFETCH(slot.components[j]);
+                    }
+                }
+                TECS_PREFETCH(&entityArray()[slot.entity]);
+                ++resolved;
+            }
+
+            if (consumed == filled) {
+                return;
+            }
+
+            Slot& slot = slots[consumed % Window];
+            ++consumed;
+            bool skip = false;
+            for (u32 j = 0; j < count; ++j) {
+                skip = skip || slot.components[j] == nullptr;
+            }
+            if (!skip) {
+                invokeWithComponents<Components...>(f, entityArray()[slot.entity].handle,
+                                                    slot.components,
+                                                    std::index_sequence_for<Components...>{});
+            }
         }
-        return nullptr;
     }
 
     /**
-     * @brief Access existing entity component's data
-     * No checks are made, use only if you know the entity and component exists.
-     * Otherwise, undefined behavior
-     *
-     * @param <T> The component type
-     * @param entity the entity handle
-     *
-     * @return the pointer
+     * @brief Walks the dense entities of all containers in lockstep,
+     * every container must be sorted by entity.
+     * Each cursor leaps to the highest entity seen, matches are read
+     * in place without touching the sparse ids.
      */
-    template <typename T>
-    T* accessExistingComponentData(u32 entity)
+    template <typename... Components, typename F>
+    void forEachMergeJoin(F& f)
     {
-        return (T*)accessExistingComponentData(TypeProvider::template TypeId<T>(), entity);
+        constexpr u32 count = sizeof...(Components);
+        DenseCursor cursors[] = {
+            {&containers[TypeProvider::template TypeId<Components>()], &allocator}...};
+        for (DenseCursor& cursor : cursors) {
+            cursor.seek(0);
+            if (!cursor.next()) {
+                return;
+            }
+        }
+
+        for (;;) {
+            u32 target = cursors[0].entity->id;
+            for (u32 j = 1; j < count; ++j) {
+                target = cursors[j].entity->id > target ? cursors[j].entity->id : target;
+            }
+
+            bool matched = true;
+            for (DenseCursor& cursor : cursors) {
+                while (cursor.entity->id < target) {
+                    if (!cursor.next()) {
+                        return;
+                    }
+                }
+                matched = matched && cursor.entity->id == target;
+            }
+            if (!matched) {
+                continue;
+            }
+
+            char* components[count];
+            for (u32 j = 0; j < count; ++j) {
+                components[j] = cursors[j].data;
+            }
+            invokeWithComponents<Components...>(f, entityArray()[target].handle, components,
+                                                std::index_sequence_for<Components...>{});
+            for (DenseCursor& cursor : cursors) {
+                if (!cursor.next()) {
+                    return;
+                }
+            }
+        }
     }
 
+    // Relative costs used by planQuery, a random sparse probe is the unit
+    static constexpr float ProbeCost = 1.0f;
+    static constexpr float ResolveCost = 1.0f;
+    static constexpr float BitsetWordCost = 0.125f;
+    static constexpr float MergeStepCost = 0.5f;
+
+    // Entities resolved ahead of the callback by PrefetchedProbeJoin
+    static constexpr u32 PrefetchDistance = 8;
+
     /**
-     * @brief Access existing entity component's data
-     * No checks are made, use only if you know the entity and component exists.
-     * Otherwise, undefined behavior
-     *
-     * @param type The component type
-     * @param entity the entity handle
-     *
-     * @return the pointer
+     * @brief Advances one in the linked list of free handles
      */
-    void* accessExistingComponentData(u32 type, u32 entity)
+    void forwardFreeIndex(ComponentContainer& c)
     {
-        ComponentContainer& c = containers[type];
-        ComponentHandle component =
-            c.sparseIds[entity / c.idChunkSize][entity % c.idChunkSize];
-        return c.denseData[component / c.chunkSize] + (component % c.chunkSize) * c.componentSize;
+        c.freeComponentHandle.nextFree =
+            ((ChunkEmptyEntry*)denseComponent(c, c.freeComponentHandle.nextFree))->nextFree;
+    }
+
+    // Save current nextFree at component location
+    void replaceDenseComponentFreeIndex(ComponentContainer& c, u32 freeHandle)
+    {
+        // Dense entities stay parallel to the dense data, so the freed entry
+        // becomes a hole until the handle is recycled.
+        // Moving the last entry in would break component references.
+        denseEntity(c, freeHandle) = {};
+        c.changedChunks |= ChunkMask(1) << (freeHandle / c.chunkSize);
+        if ((c.regionChunks >> (freeHandle / c.chunkSize)) & 1) {
+            // Region entries are only given back by unloadRegion()
+            return;
+        }
+
+        ((ChunkEmptyEntry*)denseComponent(c, freeHandle))->nextFree =
+            c.freeComponentHandle.nextFree;
+        c.freeComponentHandle.nextFree = freeHandle;
+    }
+
+protected:
+    ArenaAllocator allocator;
+
+    // Free list head: entity id in the low half, count of pushes in the high
+    // half, @see newEntityConcurrent()
+    std::uint64_t freeEntities = 0;
+    static constexpr std::uint64_t FreeEntitiesTagOne = std::uint64_t(1) << 32;
+    static constexpr std::uint64_t FreeEntitiesTagMask = ~std::uint64_t(0) << 32;
+    std::uint32_t destroyedEntities = 0; // @see destroyEntityConcurrent()
+    std::uint32_t entityIds = 0; // Ids handed out, the next fresh id follows
+    EntityBitset disabledEntities = {}; // Allocated on the first disable, @see setEntityEnabled()
+    u32 disabledCount = 0;
+    u32 liveEntities = 0;
+    u32 maxEntities;
+    std::array<Region, MaxRegions> regions = {}; // @see createRegion()
+    u32 regionCount = 0;
+    ArenaOffset emptyDenseChunk = 0; // Owners of dropped region chunks, all holes
+    ArenaOffset regionPages = 0; // Region of each sparse page of ids, 0 for none
+    static constexpr u32 componentsPerChunk = 128;
+    ArenaOffset entities = 0; // index 0 is reserved
+
+    // Records of structural changes, @see enableJournal()
+    ArenaOffset journal = 0; // 0 while not recording
+    u32 journalSize = 0;
+    u32 journalUsed = 0;
+    std::uint32_t journalRecordsLost = 0; // Since the last flush, set from many threads
+
+    std::array<ComponentContainer, MaxComponents> containers;
+};
+
+#ifdef TECS_HAS_MMAP
+/**
+ * Named shared memory segment, @see SharedWorld
+ * The creator owns the name and removes it when released.
+ */
+class SharedMemory {
+public:
+    SharedMemory()
+    {
+    }
+
+    SharedMemory(const SharedMemory&) = delete;
+    SharedMemory& operator=(const SharedMemory&) = delete;
+
+    ~SharedMemory()
+    {
+        release();
     }
 
     /**
-     * @brief Removes the component from a entity.
-     * Does nothing if the entity is invalid.
+     * @brief Creates a segment, fails if one with the name exists.
      *
-     * @param <T> component type
-     * @param entity the entity
+     * @param name POSIX shared memory name, like "/world"
+     * @param replace unlink an existing segment first, for one left behind
+     * by a crashed process. Processes still mapping it are detached.
      */
-    template <typename T>
-    void removeComponent(EntityHandle entityHandle)
+    bool create(const char* name, u32 size, bool replace = false)
     {
-        removeComponent(entityHandle, TypeProvider::template TypeId<T>());
+        release();
+        if (replace) {
+            ::shm_unlink(name);
+        }
+        const int fd = ::shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) {
+            return false;
+        }
+        std::snprintf(ownedName, sizeof(ownedName), "%s", name);
+        void* region = MAP_FAILED;
+        if (::ftruncate(fd, size) == 0) {
+            region = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        return mapped(region, size);
     }
 
     /**
-     * @brief Removes the component from a entity.
-     * Does nothing if the entity is invalid.
-     *
-     * @param entity the entity
-     * @param componentType component type id (from TypeProvider)
+     * @brief Maps an existing segment read-only.
      */
-    void removeComponent(EntityHandle entityHandle, u32 compTypeId)
+    bool open(const char* name)
     {
-        if (isEntityHandleValid(entityHandle)) {
-            removeComponentOfExistingEntity(entityHandle, compTypeId);
+        release();
+        const int fd = ::shm_open(name, O_RDONLY, 0);
+        if (fd < 0) {
+            return false;
         }
-        else {
-            TECS_LOG_ERROR(
-                "Trying to remove component of invalid entity handle! " << entityHandle);
+        struct stat info;
+        void* region = MAP_FAILED;
+        if (::fstat(fd, &info) == 0) {
+            region = ::mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        return mapped(region, info.st_size);
+    }
+
+    char* data() const
+    {
+        return memory;
+    }
+
+    u32 size() const
+    {
+        return total;
+    }
+
+    void release()
+    {
+        if (memory != nullptr) {
+            ::munmap(memory, total);
         }
+        if (ownedName[0] != 0) {
+            ::shm_unlink(ownedName);
+        }
+        memory = nullptr;
+        total = 0;
+        ownedName[0] = 0;
+    }
+
+private:
+    bool mapped(void* region, std::size_t size)
+    {
+        if (region == MAP_FAILED) {
+            release();
+            return false;
+        }
+        memory = (char*)region;
+        total = size;
+        return true;
     }
 
+    char* memory = nullptr;
+    u32 total = 0;
+    char ownedName[256] = {};
+};
+
+/**
+ * Start of the shared memory of a SharedWorld.
+ * The published Ecs object is at worldOffset and its arena at arenaOffset.
+ */
+struct SharedWorldHeader {
+    // Odd while the writer changes the world
+    std::atomic<std::uint32_t> sequence;
+    std::uint32_t worldSize;
+    std::uint32_t worldOffset;
+    std::uint32_t arenaOffset;
+    std::uint32_t arenaSize;
+};
+
+static constexpr u32 SharedWorldAlignment = 64;
+
+/**
+ * @brief World with its arena in shared memory, that other processes can
+ * read with an EcsView.
+ * This process stays the only writer: changes to the world must be made
+ * between beginFrame() and endFrame(), which publishes them.
+ *
+ * @param World the Ecs type
+ */
+template <typename World>
+class SharedWorld {
+public:
     /**
-     * @brief Removes the component from an existing entity.
-     * Slight optimized version of removeComponent(entity).
-     * Use if you know that the entity is valid.
+     * @brief Creates the shared memory and an empty world in it.
      *
-     * @param entity the entity
-     * @param componentType component type id (from TypeProvider)
+     * @param name POSIX shared memory name, like "/world"
+     * @param arenaSize bytes for the world arena
+     * @param maxEntities @see Ecs::init()
+     * @param replace @see SharedMemory::create()
      */
-    void removeComponentOfExistingEntity(EntityHandle entityHandle, u32 componentType)
+    bool create(const char* name, u32 arenaSize, u32 maxEntities, bool replace = false)
     {
-        ComponentContainer& c = containers[componentType];
-        if (c.componentSize == 0) {
-            // Component not in use
-            return;
+        const u32 worldOffset = alignShared(sizeof(SharedWorldHeader));
+        const u32 arenaOffset = alignShared(worldOffset + sizeof(World));
+        if (!memory.create(name, arenaOffset + arenaSize, replace)) {
+            return false;
         }
+        header = new (memory.data()) SharedWorldHeader{
+            {0}, sizeof(World), (std::uint32_t)worldOffset, (std::uint32_t)arenaOffset,
+            (std::uint32_t)arenaSize};
+        ecs.init(ArenaAllocator(memory.data() + arenaOffset, arenaSize), maxEntities);
+        publish();
+        return true;
+    }
 
-        const u32 sparseEntityIdx = entityHandle.id / c.idChunkSize;
-        const u32 denseEntityIdx = entityHandle.id % c.idChunkSize;
-        if (c.sparseIds[sparseEntityIdx] == nullptr) {
-            // Entity didnt have the component
-            return;
-        }
-        else {
-            u32 possibleHandle = c.sparseIds[sparseEntityIdx][denseEntityIdx];
-            if (isComponentHandleValid(possibleHandle)) {
-                replaceDenseComponentFreeIndex(c, possibleHandle);
-                c.sparseIds[sparseEntityIdx][denseEntityIdx] = 0;
-                --c.aliveComponents;
-            }
-            else {
-                // Entity didnt have the component
-            }
+    World& world()
+    {
+        return ecs;
+    }
+
+    /**
+     * @brief Readers running from now on will see a torn frame.
+     */
+    void beginFrame()
+    {
+        header->sequence.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    /**
+     * @brief Publishes the world changes since beginFrame().
+     */
+    void endFrame()
+    {
+        publish();
+        header->sequence.fetch_add(1, std::memory_order_release);
+    }
+
+private:
+    static u32 alignShared(u32 offset)
+    {
+        return (offset + SharedWorldAlignment - 1) / SharedWorldAlignment * SharedWorldAlignment;
+    }
+
+    void publish()
+    {
+        std::memcpy(memory.data() + header->worldOffset, (const void*)&ecs, sizeof(World));
+    }
+
+    SharedMemory memory;
+    SharedWorldHeader* header = nullptr;
+    World ecs;
+};
+
+/**
+ * @brief Read-only view of a SharedWorld from another process.
+ * Queries run directly on the shared memory. A query overlapping a frame
+ * of the writer is reported, so its results can be dropped and the query
+ * retried.
+ *
+ * All arena references are written whole by the writer, so a torn frame
+ * reads stale or mixed values but never leaves the shared memory.
+ *
+ * @param World the Ecs type of the SharedWorld
+ */
+template <typename World>
+class EcsView {
+public:
+    /**
+     * @param name the name given to SharedWorld::create()
+     */
+    bool attach(const char* name)
+    {
+        if (!memory.open(name)) {
+            return false;
+        }
+        header = (const SharedWorldHeader*)memory.data();
+        if (memory.size() < sizeof(SharedWorldHeader) || header->worldSize != sizeof(World)) {
+            TECS_LOG_ERROR("Shared world is of another type!");
+            memory.release();
+            return false;
         }
+        return true;
     }
 
     /**
-     * @brief Check if the entity has a component
-     *
-     * @param entity the entity handle to be checked
+     * @brief Loops over the entities with the given components, like
+     * Ecs::forEach(), with read-only components.
+     * Signature: (EntityHandle handle, const Component1& c, ... etc)
      *
-     * @return false if the entity is invalid or does not have the component,
-     * true otherwise.
-     **/
-    template <typename T>
-    bool entityHasComponent(EntityHandle entity)
+     * @return false if the writer changed the world meanwhile, the callback
+     * may have seen a mix of both states
+     */
+    template <typename... Components, typename F>
+    bool forEach(F f)
     {
-        return entityHasComponent(entity, TypeProvider::template TypeId<T>());
+        const std::uint32_t sequence = header->sequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            return false;
+        }
+        std::memcpy((void*)&ecs, memory.data() + header->worldOffset, sizeof(World));
+        ecs.rebind(memory.data() + header->arenaOffset, header->arenaSize);
+        ecs.template forEach<Components...>([&](EntityHandle entity, Components&... components) {
+            f(entity, (const Components&)components...);
+        });
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return header->sequence.load(std::memory_order_relaxed) == sequence;
     }
 
     /**
-     * @brief Check if the entity has a component
-     *
-     * @param entity the entity handle to be checked
-     * @param componentType the component type (must be same as values provided
-     * by TypeProvider template)
-     *
-     * @return false if the entity is invalid or does not have the component,
-     * true otherwise.
-     **/
-    bool entityHasComponent(EntityHandle entity, u32 componentType)
+     * @return amount of frames published by the writer
+     */
+    u32 frame() const
     {
-        if (isEntityHandleValid(entity)) {
-            return getExistingEntityComponentHandle(entity.id, componentType) > 0;
-        }
-        return false;
+        return header->sequence.load(std::memory_order_acquire) / 2;
     }
 
+private:
+    SharedMemory memory;
+    const SharedWorldHeader* header = nullptr;
+    World ecs;
+};
+#endif
+
+/**
+ * @brief Ring of the last Frames states of a world, for rollback.
+ * Every buffer keeps a full clone, but saving only copies the dense data
+ * chunks changed since the buffer was last written, along with the rest of
+ * the arena.
+ *
+ * @param World the Ecs type
+ * @param Frames amount of states kept
+ */
+template <typename World, u32 Frames>
+class SnapshotRing {
+public:
     /**
-     * @brief Get the component handle for a given entity and component type
-     *
-     * @param <T> the component type
-     * @param handle the entity
-     *
-     * @return the component handle. It may be invalid if the entity does not
-     * exists
-     * or if the entity does not have the component
+     * @param memory split in Frames buffers, each must fit the used arena
+     * of the saved world
+     * @param size bytes of memory
      */
-    template <typename T>
-    ComponentHandle getEntityComponentHandle(EntityHandle handle)
+    SnapshotRing(char* memory, u32 size)
+        : memory{memory}, bufferSize{size / Frames / BufferAlignment * BufferAlignment}
     {
-        return getEntityComponentHandle(handle, TypeProvider::template TypeId<T>());
     }
 
     /**
-     * @brief Get the component handle for a given entity and component type
-     *
-     * @param handle the entity
-     * @param componentType the component type
-     *
-     * @return the component handle. It may be invalid if the entity does not
-     * exists
-     * or if the entity does not have the component
+     * @brief Saves the current state of the world as the newest frame.
+     * Takes the world changed chunks, @see Ecs::takeChangedChunks()
      */
-    ComponentHandle getEntityComponentHandle(EntityHandle handle, u32 componentType)
+    void save(World& world)
     {
-        if (isEntityHandleValid(handle)) {
-            return getExistingEntityComponentHandle(handle.id, componentType);
+        const typename World::ChangedChunks changed = world.takeChangedChunks();
+        const u32 slot = (newest + 1) % Frames;
+        if (saved < Frames) {
+            world.cloneInto(worlds[slot], ArenaAllocator(memory + slot * bufferSize, bufferSize));
         }
         else {
-            return 0;
+            // The buffer holds the oldest frame, anything changed in any of
+            // the newer frames must be copied
+            typename World::ChangedChunks pending = changed;
+            for (u32 other = 0; other < Frames; ++other) {
+                if (other != slot) {
+                    for (u32 type = 0; type < World::MaxComponents; ++type) {
+                        pending[type] |= frameChanges[other][type];
+                    }
+                }
+            }
+            world.cloneChangesInto(worlds[slot], pending);
         }
+        frameChanges[slot] = changed;
+        newest = slot;
+        saved = saved < Frames ? saved + 1 : Frames;
     }
 
     /**
-     * @brief get component handle for a entity
-     *
-     * @param entity the entity
-     * @param componentType the component type (from TypeProvider)
+     * @brief Brings the world back to a saved frame. Newer frames are
+     * dropped, the restored one stays as the newest.
      *
-     * Does not check is entity exists. If it doesnt, undefined behavior.
-     * Only use thing method if you know what you are doing.
+     * @param framesBack 0 for the newest frame, up to frames() - 1
      */
-    ComponentHandle getExistingEntityComponentHandle(u32 entity, u32 componentType)
+    void restore(World& world, u32 framesBack)
     {
-        ComponentContainer& c = containers[componentType];
-        if (c.componentSize == 0) {
-            return 0;
+        TECS_ASSERT(framesBack < saved, "Frame not saved!");
+        newest = (newest + Frames - framesBack) % Frames;
+        saved -= framesBack;
+        worlds[newest].cloneInto(world, ArenaAllocator(world.arena().memory(), world.arena().size()));
+        // The dropped buffers hold states of another timeline
+        world.markAllChanged();
+    }
+
+    /**
+     * @return amount of frames that can be restored
+     */
+    u32 frames() const
+    {
+        return saved;
+    }
+
+private:
+    static constexpr u32 BufferAlignment = 64;
+
+    char* memory;
+    u32 bufferSize;
+    u32 newest = Frames - 1;
+    u32 saved = 0;
+    std::array<World, Frames> worlds;
+    std::array<typename World::ChangedChunks, Frames> frameChanges = {};
+};
+
+/**
+ * Declares that a system reads a component, @see SystemScheduler::addSystem()
+ */
+template <typename T>
+struct Read {
+    using Component = T;
+    static constexpr bool writes = false;
+};
+
+/**
+ * Declares that a system writes a component, @see SystemScheduler::addSystem()
+ */
+template <typename T>
+struct Write {
+    using Component = T;
+    static constexpr bool writes = true;
+};
+
+/**
+ * @brief Runs systems over a world, concurrently when their declared
+ * component accesses don't conflict.
+ * A system depends on every system added before it that writes a component
+ * it accesses, or accesses a component it writes, so conflicting systems
+ * keep their registration order. Systems ready to run are queued on the
+ * worker that finished their last dependency, idle workers steal from the
+ * others.
+ * Chunked systems run as one task per dense chunk of their driving
+ * container. When two conflicting chunked systems share the driving
+ * container, each chunk of the later one only waits for the same chunk of
+ * the earlier one, so they run as a pipeline.
+ * Systems may only change the components they write. Creating or
+ * destroying entities and adding or removing components is not thread
+ * safe, except for the concurrent calls of the Ecs.
+ * Component types must be in use before running, as looking up an unused
+ * container allocates it.
+ * With TECS_ACCESS_CHECKS, every run records the components each system
+ * accesses and reports, through TECS_LOG_ERROR, any two systems that may
+ * run at the same time while one of them writes a component the other
+ * accesses. Undeclared accesses count as writes.
+ *
+ * @param World the Ecs type
+ * @param MaxSystems up to 64 systems
+ */
+template <typename World, u32 MaxSystems = 64>
+class SystemScheduler {
+public:
+    typedef std::function<void(World&)> System;
+    typedef std::function<void(World&, u32 chunk)> ChunkSystem;
+
+    /**
+     * @param threadCount workers besides the thread calling run()
+     */
+    explicit SystemScheduler(u32 threadCount)
+        : workerCount{threadCount}, queues{new WorkQueue[threadCount + 1]}
+    {
+        for (u32 w = 1; w <= workerCount; ++w) {
+            threads.emplace_back([this, w]() { workerMain(w); });
         }
-        else {
-            if (c.sparseIds[entity / c.idChunkSize] == nullptr) {
-                return 0;
-            }
-            return c.sparseIds[entity / c.idChunkSize][entity % c.idChunkSize];
+    }
+
+    ~SystemScheduler()
+    {
+        {
+            std::lock_guard<std::mutex> lock(frameMutex);
+            stopping = true;
+        }
+        frameStarted.notify_all();
+        for (std::thread& thread : threads) {
+            thread.join();
         }
     }
 
+    SystemScheduler(const SystemScheduler&) = delete;
+    SystemScheduler& operator=(const SystemScheduler&) = delete;
+
     /**
-     * @brief Check if a entity is alive
+     * @brief Adds a system, run after the conflicting systems added before.
+     * Must not be called while running.
      *
-     * @param handle the entity to check.
+     * @param <Access> Read<Component> or Write<Component> for every
+     * component the system uses
+     * @param system called with the world
+     * @param name used to report access conflicts
      *
-     * @return true if the entity is alive.
+     * @return the system index
      */
-    bool isEntityAlive(EntityHandle handle)
+    template <typename... Access>
+    u32 addSystem(System system, const char* name = nullptr)
     {
-        return entities[handle.id].handle.alive;
+        SystemInfo info = {};
+        info.name = name;
+        info.run = [system = std::move(system)](World& world, u32) { system(world); };
+        info.taskCount = 1;
+        (declareAccess<Access>(info), ...);
+        return addSystemInfo(std::move(info));
     }
 
     /**
-     * @brief return the amount of currently active components of a given type
+     * @brief Adds a system run once per dense chunk of its driving
+     * container, the component of the first access.
+     * Each run must only access components of the entities in its chunk,
+     * @see Ecs::forEachInChunk()
      *
-     * @param type the component type to check
+     * @param <Access> Read<Component> or Write<Component> for every
+     * component the system uses, the driving one first
+     * @param system called with the world and the chunk
+     * @param name used to report access conflicts
      *
-     * @return the number of active components of a type
+     * @return the system index
      */
-    u32 getComponentAmount(u32 type)
+    template <typename Driver, typename... Access>
+    u32 addChunkedSystem(ChunkSystem system, const char* name = nullptr)
     {
-        if (containers[type].componentSize == 0) {
-            return 0;
-        }
-        else {
-            return containers[type].aliveComponents;
-        }
+        SystemInfo info = {};
+        info.name = name;
+        info.run = std::move(system);
+        info.taskCount = MaxComponentChunks;
+        info.drivingType = World::Types::template TypeId<typename Driver::Component>();
+        declareAccess<Driver>(info);
+        (declareAccess<Access>(info), ...);
+        return addSystemInfo(std::move(info));
     }
 
     /**
-     * @brief Loops over all entities that contain a given set of components
-     *
-     * @param f a lambda function to be used.
-     * Signature: (EntityHandle handle, Component1& c, Component2& ... etc)
+     * @brief Runs every system once, returns when all finished.
      */
-    template <typename... Components, typename F>
-    void forEach(F f)
+    void run(World& world)
     {
-        u32 compType[] = {TypeProvider::template TypeId<Components>()...};
-        TypeAmount smallestType = findSmallestComponentContainer(
-            TypeProvider::template TypeId<Components>()...);
-        ComponentContainer& c = containers[smallestType.type];
-
-        for (u32 i = 1; i <= smallestType.count; ++i) {
-            u32 entity = c.denseEntities[i / c.chunkSize][i % c.chunkSize].id;
-            if (entity > 0) {
-                bool skip = false;
-                for (int j = 0; j < sizeof...(Components); ++j) {
-                    if (getExistingEntityComponentHandle(entity, compType[j]) == 0) {
-                        skip = true;
-                        break;
-                    }
-                }
-                if (skip) {
-                    continue;
+        if (systemCount == 0) {
+            return;
+        }
+        this->world = &world;
+        for (u32 w = 0; w <= workerCount; ++w) {
+            queues[w].head = queues[w].tail = 0;
+        }
+        u32 nextQueue = 0;
+        u32 taskCount = 0;
+        for (u32 i = 0; i < systemCount; ++i) {
+            const SystemInfo& info = systems[i];
+            unfinishedTasks[i].store(info.taskCount, std::memory_order_relaxed);
+            for (u32 chunk = 0; chunk < info.taskCount; ++chunk) {
+                pending[i][chunk].store(info.dependencies, std::memory_order_relaxed);
+                if (info.dependencies == 0) {
+                    queues[nextQueue].push(i * MaxComponentChunks + chunk);
+                    nextQueue = (nextQueue + 1) % (workerCount + 1);
                 }
-
-                Entity& e = entities[entity];
-                f(e.handle, *accessExistingComponentData<Components>(entity)...);
             }
+            taskCount += info.taskCount;
         }
-    }
+        remaining.store(taskCount, std::memory_order_relaxed);
+        busyWorkers.store(workerCount, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(frameMutex);
+            ++frame;
+        }
+        frameStarted.notify_all();
 
-    template <typename T>
-    u32 buildComponentMask(T first)
-    {
-        return first;
+        workLoop(0);
+        // Workers may still be looking for work in the queues
+        while (busyWorkers.load(std::memory_order_acquire) > 0) {
+            std::this_thread::yield();
+        }
+#if TECS_ACCESS_CHECKS
+        reportConflicts();
+#endif
     }
 
-    template <typename T, typename... Args>
-    u32 buildComponentMask(T first, Args... args)
+#if TECS_ACCESS_CHECKS
+    /**
+     * @return amount of conflicting accesses found in the last run
+     */
+    u32 accessConflicts() const
     {
-        return first | buildComponentMask(args...);
+        return conflictCount;
     }
+#endif
 
-    template <typename... Args>
-    u32 buildComponentMask()
+    /**
+     * @return amount of earlier systems the system or each of its chunks
+     * waits for
+     */
+    u32 dependencies(u32 system) const
     {
-        return buildComponentMask(TypeProvider::template TypeId<Args>()...);
+        return systems[system].dependencies;
     }
 
-    
 private:
+    static constexpr u32 AccessWords = (World::MaxComponents + BitsPerWord - 1) / BitsPerWord;
+    static_assert(MaxSystems <= 64, "Dependents of a system are a 64 bit mask!");
+
+    struct SystemInfo {
+        ChunkSystem run;
+        std::array<BitsetWord, AccessWords> reads;
+        std::array<BitsetWord, AccessWords> writes;
+        std::uint64_t dependents; // Systems waiting for this one to finish
+        std::uint64_t chunkDependents; // Systems waiting for each chunk of this one
+        std::uint64_t predecessors; // Systems always run before this one, directly or not
+        const char* name;
+        u32 dependencies; // Systems this one waits for
+        u32 taskCount; // 1, or MaxComponentChunks if chunked
+        u32 drivingType; // Container split in chunks, 0 if not chunked
+    };
+
     /**
-     * @brief Check if a given component handle is valid.
-     * DOES NOT MEAN IT IS ATTACHED TO AN ENTITY.
-     * Just that it is a valid handle id to be used internally.
-     *
-     * @param handle the component handle
-     *
-     * @return true if the component belongs to a live entity.
+     * Tasks queued on a worker, system * MaxComponentChunks + chunk.
+     * Every task is queued once per run, so the queue never wraps.
      */
-    bool isComponentHandleValid(ComponentHandle handle)
+    struct WorkQueue {
+        std::mutex mutex;
+        u32 tasks[MaxSystems * MaxComponentChunks];
+        u32 head = 0;
+        u32 tail = 0;
+
+        void push(u32 task)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks[tail++] = task;
+        }
+
+        // The owner takes the newest task, whose data is likely still cached
+        bool pop(u32& task)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (tail == head) {
+                return false;
+            }
+            task = tasks[--tail];
+            return true;
+        }
+
+        bool steal(u32& task)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (tail == head) {
+                return false;
+            }
+            task = tasks[head++];
+            return true;
+        }
+    };
+
+    u32 addSystemInfo(SystemInfo&& info)
     {
-        return handle > 0 && handle <= componentsPerChunk * MaxComponentChunks;
+        TECS_ASSERT(systemCount < MaxSystems, "Too many systems!");
+        const u32 index = systemCount++;
+        for (u32 earlier = 0; earlier < index; ++earlier) {
+            SystemInfo& other = systems[earlier];
+            if (conflicts(other, info)) {
+                const bool pipelined = other.drivingType != 0 && other.drivingType == info.drivingType;
+                (pipelined ? other.chunkDependents : other.dependents) |= std::uint64_t(1) << index;
+                info.predecessors |= other.predecessors | (std::uint64_t(1) << earlier);
+                ++info.dependencies;
+            }
+        }
+        systems[index] = std::move(info);
+        return index;
     }
 
-    /**
-     * @brief Fetch a component address
-     * No checks are made. Assumes component handle is valid.
-     */
-    template <typename T>
-    T* getComponent(ComponentContainer& container, ComponentHandle handle)
+    template <typename Access>
+    static void declareAccess(SystemInfo& info)
     {
-        u32 chunkIdx = handle / componentsPerChunk;
-        u32 insideChunkIdx = (handle % componentsPerChunk) * container.componentSize;
-        T* addr = (T*)(container.denseData[chunkIdx] + insideChunkIdx);
-        return addr;
+        const u32 type = World::Types::template TypeId<typename Access::Component>();
+        auto& mask = Access::writes ? info.writes : info.reads;
+        mask[type / BitsPerWord] |= BitsetWord(1) << (type % BitsPerWord);
     }
 
-    ComponentContainer& ensureComponentContainer(u32 typeId, u32 compSize)
+    static bool conflicts(const SystemInfo& a, const SystemInfo& b)
     {
-        TECS_ASSERT(
-            compSize >= sizeof(ChunkEmptyEntry),
-            "Compsize must be at least size of ChunkEmptyEntry (4 bytes)");
-        ComponentContainer& c = containers[typeId];
-        if (c.componentSize == 0) {
-            c.componentSize = compSize;
-            // Make sure to include all possible entries
-            // with +1 to round up
-            c.chunkSize = (maxEntities / MaxComponentChunks) + 1;
-            u32 size = (maxEntities / c.idChunkSize) + 1;
-            c.sparseIds = allocator.alloc<u32*>(size);
-            c.denseData = allocator.alloc<char*>(MaxComponentChunks);
-            c.denseEntities = allocator.alloc<EntityHandle*>(MaxComponentChunks);
-            std::memset(c.sparseIds, 0, sizeof(u32*) * size);
-            std::memset(c.denseData, 0, sizeof(char*) * MaxComponentChunks);
-            std::memset(c.denseEntities, 0, sizeof(EntityHandle*) * MaxComponentChunks);
+        for (u32 w = 0; w < AccessWords; ++w) {
+            if ((a.writes[w] & (b.reads[w] | b.writes[w])) || (b.writes[w] & a.reads[w])) {
+                return true;
+            }
         }
-        return c;
-    }
-
-    inline EntityHandle& denseEntity(tecs::ComponentContainer& c, const u32 entity) {
-        return c.denseEntities[entity / c.chunkSize][entity % c.chunkSize];
+        return false;
     }
 
-    void* accessComponentData(tecs::ComponentContainer& c, const u32 componentHandle)
+    void workerMain(u32 worker)
     {
-        TECS_ASSERT(componentHandle <= c.chunkSize * MaxComponentChunks, "no enough space!");
-        u32 compSparse = componentHandle / c.chunkSize;
-        if (c.denseData[compSparse] == nullptr) {
-            // Allocate dense data chunk
-            const u32 chunkDataSize = c.componentSize * c.chunkSize;
-            c.denseData[compSparse] = allocator.alloc<char>(chunkDataSize);
-            c.denseEntities[compSparse] = allocator.alloc<EntityHandle>(c.chunkSize);
-            return c.denseData[compSparse] + (componentHandle % c.chunkSize) * c.componentSize;
-        }
-        else {
-            return c.denseData[compSparse] + (componentHandle % c.chunkSize) * c.componentSize;
+        u32 seenFrame = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(frameMutex);
+                frameStarted.wait(lock, [&]() { return stopping || frame != seenFrame; });
+                if (stopping) {
+                    return;
+                }
+                seenFrame = frame;
+            }
+            workLoop(worker);
+            busyWorkers.fetch_sub(1, std::memory_order_release);
         }
     }
 
-    void pushDenseEntity(ComponentContainer& c, EntityHandle entity)
+    void workLoop(u32 worker)
     {
-        ++c.aliveComponents;
-        denseEntity(c, c.aliveComponents) = entity;
+        while (remaining.load(std::memory_order_acquire) > 0) {
+            u32 task;
+            if (queues[worker].pop(task) || steal(worker, task)) {
+                execute(worker, task);
+            }
+            else {
+                std::this_thread::yield();
+            }
+        }
     }
 
-    struct TypeAmount {
-        u32 type;
-        u32 count;
-    };
-
-    TypeAmount findSmallestComponentContainer(u32 type)
+    bool steal(u32 worker, u32& task)
     {
-        return {type, getComponentAmount(type)};
+        for (u32 i = 1; i <= workerCount; ++i) {
+            if (queues[(worker + i) % (workerCount + 1)].steal(task)) {
+                return true;
+            }
+        }
+        return false;
     }
 
-    template <typename C, typename... Components>
-    TypeAmount findSmallestComponentContainer(C type, Components... types)
+    void execute(u32 worker, u32 task)
     {
-        auto a = findSmallestComponentContainer(type);
-        auto b = findSmallestComponentContainer(types...);
-        return (a.count < b.count) ? a : b;
+        const u32 system = task / MaxComponentChunks;
+        const u32 chunk = task % MaxComponentChunks;
+        const SystemInfo& info = systems[system];
+#if TECS_ACCESS_CHECKS
+        AccessRecorder recorder = {system, info.reads.data(), readers.data(), writers.data()};
+        currentAccessRecorder = &recorder;
+        info.run(*world, chunk);
+        currentAccessRecorder = nullptr;
+#else
+        info.run(*world, chunk);
+#endif
+
+        std::uint64_t dependents = info.chunkDependents;
+        while (dependents != 0) {
+            const u32 dependent = countTrailingZeros(dependents);
+            dependents &= dependents - 1;
+            release(worker, dependent, chunk);
+        }
+        if (unfinishedTasks[system].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            dependents = info.dependents;
+            while (dependents != 0) {
+                const u32 dependent = countTrailingZeros(dependents);
+                dependents &= dependents - 1;
+                for (u32 c = 0; c < systems[dependent].taskCount; ++c) {
+                    release(worker, dependent, c);
+                }
+            }
+        }
+        remaining.fetch_sub(1, std::memory_order_release);
     }
 
+#if TECS_ACCESS_CHECKS
     /**
-     * @brief Advances one in the linked list of free handles
+     * @brief Reports the systems that accessed a component in the last run
+     * without being ordered, while at least one wrote it. Chunks of
+     * pipelined systems count as ordered.
      */
-    void forwardFreeIndex(ComponentContainer& c)
+    void reportConflicts()
     {
-        const u32 sparseIdx = c.freeComponentHandle.nextFree / c.chunkSize;
-        const u32 denseIdx = c.freeComponentHandle.nextFree % c.chunkSize;
-        c.freeComponentHandle.nextFree =
-            ((ChunkEmptyEntry*)(c.denseData[sparseIdx] + denseIdx))->nextFree;
+        conflictCount = 0;
+        for (u32 type = 0; type < World::MaxComponents; ++type) {
+            const std::uint64_t writing = writers[type].exchange(0, std::memory_order_relaxed);
+            const std::uint64_t accessing = writing | readers[type].exchange(0, std::memory_order_relaxed);
+            std::uint64_t unchecked = writing;
+            while (unchecked != 0) {
+                const u32 writer = countTrailingZeros(unchecked);
+                unchecked &= unchecked - 1;
+                // Two writers are reported once, by the first
+                const std::uint64_t earlier = (std::uint64_t(1) << writer) - 1;
+                std::uint64_t others = accessing & ~(writing & earlier) & ~(std::uint64_t(1) << writer);
+                while (others != 0) {
+                    const u32 other = countTrailingZeros(others);
+                    others &= others - 1;
+                    if (ordered(writer, other)) {
+                        continue;
+                    }
+                    char message[256];
+                    std::snprintf(message, sizeof(message),
+                                  "Systems %s and %s may run concurrently, %s writes component "
+                                  "type %u accessed by both",
+                                  systemName(writer).data(), systemName(other).data(),
+                                  systemName(writer).data(), unsigned(type));
+                    TECS_LOG_ERROR(message);
+                    ++conflictCount;
+                }
+            }
+        }
     }
 
-    // Save current nextFree at component location
-    void replaceDenseComponentFreeIndex(ComponentContainer& c, u32 freeHandle)
+    bool ordered(u32 a, u32 b) const
     {
-        const u32 sparseIdx = freeHandle / c.chunkSize;
-        const u32 denseIdx = (freeHandle % c.chunkSize);
-
-        // Replace destroyed entity index with last entry, so we don't have
-        // holes in the dense entities vector
-        // This then will point to the next valid data index
-        // TODO: Consider if this is worth it since we might be fragmenting the vector...
-        // TODO: Do some benchmarks related to this
-        denseEntity(c, freeHandle) = denseEntity(c, c.aliveComponents);
-        denseEntity(c, c.aliveComponents) = {};
+        return ((systems[a].predecessors >> b) & 1) || ((systems[b].predecessors >> a) & 1);
+    }
 
-        ((ChunkEmptyEntry*)(c.denseData[sparseIdx] + denseIdx * c.componentSize))->nextFree =
-            c.freeComponentHandle.nextFree;
-        c.freeComponentHandle.nextFree = freeHandle;
+    std::array<char, 64> systemName(u32 system) const
+    {
+        std::array<char, 64> name;
+        if (systems[system].name != nullptr) {
+            std::snprintf(name.data(), name.size(), "'%s'", systems[system].name);
+        }
+        else {
+            std::snprintf(name.data(), name.size(), "#%u", unsigned(system));
+        }
+        return name;
     }
+#endif
 
-protected:
-    ArenaAllocator allocator;
+    // Queues the chunk of a system once it stops waiting
+    void release(u32 worker, u32 system, u32 chunk)
+    {
+        if (pending[system][chunk].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            queues[worker].push(system * MaxComponentChunks + chunk);
+        }
+    }
 
-    u32 nextFreeEntity;
-    u32 liveEntities = 0;
-    u32 maxEntities;
-    static constexpr u32 componentsPerChunk = 128;
-    Entity* entities = 0; // index 0 is reserved
+    std::array<SystemInfo, MaxSystems> systems;
+    u32 systemCount = 0;
+    std::array<std::array<std::atomic<u32>, MaxComponentChunks>, MaxSystems> pending;
+    std::array<std::atomic<u32>, MaxSystems> unfinishedTasks;
+    std::atomic<u32> remaining{0}; // Tasks of the current run
+#if TECS_ACCESS_CHECKS
+    std::array<std::atomic<std::uint64_t>, World::MaxComponents> readers = {};
+    std::array<std::atomic<std::uint64_t>, World::MaxComponents> writers = {};
+    u32 conflictCount = 0;
+#endif
+    World* world = nullptr;
 
-    std::array<ComponentContainer, MaxComponents> containers;
+    u32 workerCount;
+    std::unique_ptr<WorkQueue[]> queues; // Queue 0 belongs to the thread calling run()
+    std::vector<std::thread> threads;
+    std::atomic<u32> busyWorkers{0};
+    std::mutex frameMutex;
+    std::condition_variable frameStarted;
+    u32 frame = 0;
+    bool stopping = false;
 };
 
 } // namespace tecs
@@ -1,6 +1,10 @@
 #include <iostream>
 #include <chrono>
+#include <cstring>
+#include <memory>
 #include <string_view>
+#include <thread>
+#include <vector>
 
 #include "catch2/catch.hpp"
 
@@ -75,6 +79,28 @@ TEST_CASE("Create many entities", "[Benchmark]")
     timer.stop("Create 100.000 entities");
 }
 
+TEST_CASE("Create many entities from 4 threads", "[Benchmark]")
+{
+    constexpr u32 threadCount = 4;
+    constexpr u32 entityCount = 1000000;
+    MemoryReadyEcs ecs(MEGABYTES(64), entityCount);
+
+    Timer timer;
+    std::vector<std::thread> threads;
+    for (u32 t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&]() {
+            for (u32 i = 0; i < entityCount / threadCount; ++i) {
+                ecs.newEntityConcurrent();
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    timer.stop("Creating 1M entities from 4 threads");
+    REQUIRE(ecs.getEntityAmount() == entityCount);
+}
+
 TEST_CASE("Create many entities with 2 components", "[Benchmark]")
 {
     const auto entitiesCount = 100'000;
@@ -89,6 +115,55 @@ TEST_CASE("Create many entities with 2 components", "[Benchmark]")
     timer.stop("Create 100.000 entities with 2 components");
 }
 
+TEST_CASE("Add 1M components staged from 4 threads", "[Benchmark]")
+{
+    constexpr u32 threadCount = 4;
+    constexpr u32 entityCount = 1000000;
+    MemoryReadyEcs serial(MEGABYTES(128), entityCount);
+    MemoryReadyEcs ecs(MEGABYTES(128), entityCount);
+    for (u32 i = 0; i < entityCount; ++i) {
+        serial.newEntity();
+        ecs.newEntity();
+    }
+
+    Timer timer;
+    for (u32 i = 1; i <= entityCount; ++i) {
+        serial.addComponent<Component2>({1, 0, i}) = {long(i), long(i)};
+    }
+    timer.stop("Adding 1M components serially");
+
+    constexpr u32 stagingSize = 32 * 1024 * 1024;
+    std::unique_ptr<char[]> stagingMemory(new char[stagingSize]);
+    tecs::ArenaAllocator stagingArena(stagingMemory.get(), stagingSize);
+    tecs::ComponentStaging<Component2> stagings[threadCount];
+    for (u32 t = 0; t < threadCount; ++t) {
+        stagings[t] = tecs::ComponentStaging<Component2>(stagingArena, entityCount / threadCount);
+    }
+
+    timer.start();
+    std::vector<std::thread> threads;
+    for (u32 t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t]() {
+            for (u32 i = t + 1; i <= entityCount; i += threadCount) {
+                stagings[t].add({1, 0, i}) = {long(i), long(i)};
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    ecs.prepareStaged(stagings, threadCount);
+    threads.clear();
+    for (u32 t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t]() { ecs.mergeStaged(stagings[t]); });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    timer.stop("Adding 1M components staged from 4 threads");
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component2>()) == entityCount);
+}
+
 TEST_CASE("Iterate over many entities with 2 components", "[Benchmark]")
 {
     const auto entitiesCount = 100'000;
@@ -161,7 +236,7 @@ TEST_CASE("Iterate over 1M entities with 2 components",
           "[Benchmark]")
 {
     const auto entitiesCount = 1'000'000;
-    MemoryReadyEcs ecs(MEGABYTES(32), entitiesCount);
+    MemoryReadyEcs ecs(MEGABYTES(80), entitiesCount);
 
     for (long i = 0; i < entitiesCount; ++i) {
         tecs::EntityHandle entity = ecs.newEntity();
@@ -182,7 +257,7 @@ TEST_CASE("Iterate over 1M entities with 2 components, some missing",
           "[Benchmark]")
 {
     const auto entitiesCount = 1'000'000;
-    MemoryReadyEcs ecs(MEGABYTES(30), entitiesCount);
+    MemoryReadyEcs ecs(MEGABYTES(80), entitiesCount);
 
     for (long i = 0; i < entitiesCount; ++i) {
         tecs::EntityHandle entity = ecs.newEntity();
@@ -207,7 +282,7 @@ TEST_CASE("Iterate over 1M entities with 2 components, half contain components",
           "[Benchmark]")
 {
     const auto entitiesCount = 1'000'000;
-    MemoryReadyEcs ecs(MEGABYTES(28), entitiesCount);
+    MemoryReadyEcs ecs(MEGABYTES(80), entitiesCount);
 
     for (long i = 0; i < entitiesCount; ++i) {
         tecs::EntityHandle entity = ecs.newEntity();
@@ -230,7 +305,7 @@ TEST_CASE("Iterate over 1M entities with 2 components, less than half",
           "[Benchmark]")
 {
     const auto entitiesCount = 1'000'000;
-    MemoryReadyEcs ecs(MEGABYTES(28), entitiesCount);
+    MemoryReadyEcs ecs(MEGABYTES(80), entitiesCount);
 
     for (long i = 0; i < entitiesCount; ++i) {
         tecs::EntityHandle entity = ecs.newEntity();
@@ -249,4 +324,488 @@ TEST_CASE("Iterate over 1M entities with 2 components, less than half",
         c2.y = 2;
     });
     timer.stop("Iterate over 1M with 2 components, less than half");
-}
\ No newline at end of file
+}
+
+TEST_CASE("Iterate over 1M entities with 2 components, some missing, by strategy",
+          "[Benchmark]")
+{
+    const auto entitiesCount = 1'000'000;
+    MemoryReadyEcs ecs(MEGABYTES(80), entitiesCount);
+
+    for (long i = 0; i < entitiesCount; ++i) {
+        tecs::EntityHandle entity = ecs.newEntity();
+        if ((i % 7) != 0) {
+            ecs.addComponent<Component1>(entity) = {i};
+        }
+        if ((i % 13) != 0) {
+            ecs.addComponent<Component2>(entity) = {i, i};
+        }
+    }
+
+    Timer timer;
+    ecs.forEach<Component1, Component2>(tecs::QueryStrategy::ProbeJoin,
+                                        [](auto, Component1& c1, Component2& c2) {
+                                            c1.x = 0;
+                                            c2.x = 1;
+                                            c2.y = 2;
+                                        });
+    timer.stop("Iterate over 1M with 2 components, some missing (probe join)");
+
+    timer.start();
+    ecs.forEach<Component1, Component2>(tecs::QueryStrategy::BitsetIntersection,
+                                        [](auto, Component1& c1, Component2& c2) {
+                                            c1.x = 0;
+                                            c2.x = 1;
+                                            c2.y = 2;
+                                        });
+    timer.stop("Iterate over 1M with 2 components, some missing (bitset intersection)");
+}
+
+TEST_CASE("Iterate over 1M entities with 2 components, less than half, by strategy",
+          "[Benchmark]")
+{
+    const auto entitiesCount = 1'000'000;
+    MemoryReadyEcs ecs(MEGABYTES(80), entitiesCount);
+
+    for (long i = 0; i < entitiesCount; ++i) {
+        tecs::EntityHandle entity = ecs.newEntity();
+        if ((i % 2) != 0) {
+            ecs.addComponent<Component1>(entity) = {i};
+        }
+        if ((i % 3) != 0) {
+            ecs.addComponent<Component2>(entity) = {i, i};
+        }
+    }
+
+    Timer timer;
+    ecs.forEach<Component1, Component2>(tecs::QueryStrategy::ProbeJoin,
+                                        [](auto, Component1& c1, Component2& c2) {
+                                            c1.x = 0;
+                                            c2.x = 1;
+                                            c2.y = 2;
+                                        });
+    timer.stop("Iterate over 1M with 2 components, less than half (probe join)");
+
+    timer.start();
+    ecs.forEach<Component1, Component2>(tecs::QueryStrategy::BitsetIntersection,
+                                        [](auto, Component1& c1, Component2& c2) {
+                                            c1.x = 0;
+                                            c2.x = 1;
+                                            c2.y = 2;
+                                        });
+    timer.stop("Iterate over 1M with 2 components, less than half (bitset intersection)");
+}
+
+TEST_CASE("Iterate over 1M entities with 2 components sorted by entity",
+          "[Benchmark]")
+{
+    const auto entitiesCount = 1'000'000;
+    MemoryReadyEcs ecs(MEGABYTES(80), entitiesCount);
+
+    std::vector<tecs::EntityHandle> entities;
+    for (long i = 0; i < entitiesCount; ++i) {
+        tecs::EntityHandle entity = ecs.newEntity();
+        entities.push_back(entity);
+        if ((i % 7) != 0) {
+            ecs.addComponent<Component1>(entity) = {i};
+        }
+        if ((i % 13) != 0) {
+            ecs.addComponent<Component2>(entity) = {i, i};
+        }
+    }
+    // Recycle handles so the dense storage is no longer in entity order
+    for (long i = 0; i < entitiesCount; i += 3) {
+        ecs.removeComponent<Component1>(entities[i]);
+    }
+    for (long i = entitiesCount - 1; i >= 0; i -= 3) {
+        ecs.addComponent<Component1>(entities[i]) = {i};
+    }
+
+    auto update = [](auto, Component1& c1, Component2& c2) {
+        c1.x = 0;
+        c2.x = 1;
+        c2.y = 2;
+    };
+
+    Timer timer;
+    ecs.forEach<Component1, Component2>(tecs::QueryStrategy::ProbeJoin, update);
+    timer.stop("Iterate over 1M with 2 components, unsorted (probe join)");
+
+    timer.start();
+    ecs.sortByEntity<Component1>();
+    timer.stop("Sort 1M components by entity");
+
+    timer.start();
+    ecs.forEach<Component1, Component2>(tecs::QueryStrategy::ProbeJoin, update);
+    timer.stop("Iterate over 1M with 2 components, sorted (probe join)");
+
+    timer.start();
+    ecs.forEach<Component1, Component2>(tecs::QueryStrategy::BitsetIntersection, update);
+    timer.stop("Iterate over 1M with 2 components, sorted (bitset intersection)");
+
+    timer.start();
+    ecs.forEach<Component1, Component2>(tecs::QueryStrategy::MergeJoin, update);
+    timer.stop("Iterate over 1M with 2 components, sorted (merge join)");
+}
+
+TEST_CASE("Iterate over 1M entities with 2 components, prefetched probing",
+          "[Benchmark]")
+{
+    const auto entitiesCount = 1'000'000;
+    MemoryReadyEcs ecs(MEGABYTES(80), entitiesCount);
+
+    std::vector<tecs::EntityHandle> entities;
+    for (long i = 0; i < entitiesCount; ++i) {
+        tecs::EntityHandle entity = ecs.newEntity();
+        entities.push_back(entity);
+        ecs.addComponent<Component1>(entity) = {i};
+        if ((i % 13) != 0) {
+            ecs.addComponent<Component2>(entity) = {i, i};
+        }
+    }
+    // Scatter the driving container so probes hit random sparse pages
+    ecs.sort<Component1>([](const Component1& a, const Component1& b) {
+        return (a.x * 7919) % 1'000'003 < (b.x * 7919) % 1'000'003;
+    });
+
+    auto update = [](auto, Component1& c1, Component2& c2) {
+        c1.x = 0;
+        c2.x = 1;
+        c2.y = 2;
+    };
+
+    // Warm up, so both runs start with the same cache state
+    ecs.forEach<Component1, Component2>(tecs::QueryStrategy::ProbeJoin, update);
+
+    Timer timer;
+    ecs.forEach<Component1, Component2>(tecs::QueryStrategy::ProbeJoin, update);
+    timer.stop("Iterate over 1M with 2 components, scattered (probe join)");
+
+    timer.start();
+    ecs.forEach<Component1, Component2>(tecs::QueryStrategy::PrefetchedProbeJoin, update);
+    timer.stop("Iterate over 1M with 2 components, scattered (prefetched probe join)");
+}
+
+TEST_CASE("Encode delta of 100k entities", "[Benchmark]")
+{
+    const auto entitiesCount = 100'000;
+    const u32 memSize = MEGABYTES(10);
+    MemoryReadyEcs ecs(memSize, entitiesCount);
+
+    std::vector<tecs::EntityHandle> entities;
+    for (long i = 0; i < entitiesCount; ++i) {
+        tecs::EntityHandle entity = ecs.newEntity();
+        entities.push_back(entity);
+        ecs.addComponent<Component1>(entity) = {i};
+        ecs.addComponent<Component2>(entity) = {i, i};
+    }
+
+    // Baseline as the client has it, @see tecs::Ecs::rebind()
+    auto baselineMemory = std::make_unique<char[]>(memSize);
+    std::memcpy(baselineMemory.get(), ecs.arena().memory(), ecs.arena().usedSize());
+    tecs::Ecs<ComponentTypes, 8> baseline = ecs;
+    baseline.rebind(baselineMemory.get(), memSize);
+
+    // A tick: 10% of the entities move, some come and go
+    for (long i = 0; i < entitiesCount; i += 10) {
+        ecs.getComponent<Component2>(entities[i])->x += 1;
+    }
+    for (long i = 0; i < 1000; ++i) {
+        ecs.removeEntity(entities[i * 97]);
+        ecs.addComponent<Component1>(ecs.newEntity()) = {i};
+    }
+
+    std::vector<char> delta(memSize);
+    Timer timer;
+    const u32 size = ecs.encodeDelta(baseline, delta.data(), delta.size());
+    timer.stop("Encode delta of 100k entities");
+    REQUIRE(size > 0);
+    std::cout << "Delta of " << size << " bytes, full state is " << ecs.arena().usedSize()
+              << " bytes" << std::endl;
+
+    timer.start();
+    REQUIRE(baseline.applyDelta(delta.data(), size));
+    timer.stop("Apply delta of 100k entities");
+}
+
+TEST_CASE("Save 100k entities to a snapshot ring", "[Benchmark]")
+{
+    const auto entitiesCount = 100'000;
+    const u32 memSize = MEGABYTES(10);
+    MemoryReadyEcs ecs(memSize, entitiesCount);
+    for (long i = 0; i < entitiesCount; ++i) {
+        tecs::EntityHandle entity = ecs.newEntity();
+        ecs.addComponent<Component1>(entity) = {i};
+        ecs.addComponent<Component2>(entity) = {i, i};
+    }
+
+    constexpr u32 frames = 8;
+    auto cloneMemory = std::make_unique<char[]>(memSize * frames);
+    tecs::Ecs<ComponentTypes, 8> clone;
+    auto ringMemory = std::make_unique<char[]>(memSize * frames);
+    tecs::SnapshotRing<tecs::Ecs<ComponentTypes, 8>, frames> ring(ringMemory.get(),
+                                                                 memSize * frames);
+    // Fill the ring and the clone buffers, so every save is incremental
+    for (u32 i = 0; i < frames; ++i) {
+        ring.save(ecs);
+        ecs.cloneInto(clone, tecs::ArenaAllocator(cloneMemory.get() + i * memSize, memSize));
+    }
+
+    auto simulate = [&]() {
+        ecs.forEach<Component1>([](auto, Component1& c1) { c1.x += 1; });
+    };
+
+    Timer timer;
+    for (u32 i = 0; i < 100; ++i) {
+        simulate();
+    }
+    timer.stop("Simulate 100k entities 100 frames");
+
+    timer.start();
+    for (u32 i = 0; i < 100; ++i) {
+        simulate();
+        const u32 buffer = i % frames;
+        ecs.cloneInto(clone, tecs::ArenaAllocator(cloneMemory.get() + buffer * memSize, memSize));
+    }
+    timer.stop("Simulate and clone 100k entities 100 frames");
+
+    timer.start();
+    for (u32 i = 0; i < 100; ++i) {
+        simulate();
+        ring.save(ecs);
+    }
+    timer.stop("Simulate and save 100k entities to the ring 100 frames");
+}
+
+TEST_CASE("Fork a world and change some components", "[Benchmark]")
+{
+    const auto entitiesCount = 500'000;
+    const u32 memSize = MEGABYTES(40);
+    tecs::ForkableMemory memory;
+    REQUIRE(memory.create(memSize));
+    tecs::Ecs<ComponentTypes, 8> ecs(tecs::ArenaAllocator(memory.data(), memSize), entitiesCount);
+    std::vector<tecs::EntityHandle> entities;
+    for (long i = 0; i < entitiesCount; ++i) {
+        tecs::EntityHandle entity = ecs.newEntity();
+        entities.push_back(entity);
+        ecs.addComponent<Component1>(entity) = {i};
+        ecs.addComponent<Component2>(entity) = {i, i};
+    }
+    std::cout << "World of " << ecs.arena().usedSize() << " bytes" << std::endl;
+
+    // A plan changes a few entities
+    auto simulate = [&](tecs::Ecs<ComponentTypes, 8>& world) {
+        for (long i = 0; i < 100; ++i) {
+            world.getComponent<Component2>(entities[i * 4999])->x += 1;
+        }
+    };
+
+    auto cloneMemory = std::make_unique<char[]>(memSize);
+    tecs::Ecs<ComponentTypes, 8> clone;
+    Timer timer;
+    for (u32 i = 0; i < 10; ++i) {
+        ecs.cloneInto(clone, tecs::ArenaAllocator(cloneMemory.get(), memSize));
+        simulate(clone);
+    }
+    timer.stop("Clone and change 100 components 10 times");
+
+    timer.start();
+    for (u32 i = 0; i < 10; ++i) {
+        tecs::Ecs<ComponentTypes, 8> fork;
+        tecs::SnapshotMapping forkMemory = ecs.forkInto(fork, memory);
+        simulate(fork);
+    }
+    timer.stop("Fork and change 100 components 10 times");
+}
+
+TEST_CASE("Export 1M components as columns", "[Benchmark]")
+{
+    const auto entitiesCount = 1'000'000;
+    MemoryReadyEcs ecs(MEGABYTES(80), entitiesCount);
+    for (long i = 0; i < entitiesCount; ++i) {
+        tecs::EntityHandle entity = ecs.newEntity();
+        ecs.addComponent<Component2>(entity) = {i, i};
+    }
+
+    std::vector<char> raw(entitiesCount * (sizeof(Component2) + sizeof(std::uint32_t)));
+    std::FILE* file = std::tmpfile();
+    Timer timer;
+    std::fwrite(raw.data(), 1, raw.size(), file);
+    std::fflush(file);
+    timer.stop("Write the same amount of bytes as 1M components");
+    std::fclose(file);
+
+    file = std::tmpfile();
+    timer.start();
+    REQUIRE(ecs.exportColumns<Component2>(file));
+    std::fflush(file);
+    timer.stop("Export 1M components, whole");
+    std::fclose(file);
+
+    const tecs::FieldDescriptor fields[] = {TECS_FIELD(Component2, x), TECS_FIELD(Component2, y)};
+    file = std::tmpfile();
+    timer.start();
+    REQUIRE(ecs.exportColumns<Component2>(file, fields, 2));
+    std::fflush(file);
+    timer.stop("Export 1M components, by field");
+    std::fclose(file);
+}
+
+TEST_CASE("Spread a pass over 1M entities across frames", "[Benchmark]")
+{
+    const auto entitiesCount = 1'000'000;
+    MemoryReadyEcs ecs(MEGABYTES(80), entitiesCount);
+    for (long i = 0; i < entitiesCount; ++i) {
+        tecs::EntityHandle entity = ecs.newEntity();
+        ecs.addComponent<Component1>(entity) = {i};
+        ecs.addComponent<Component2>(entity) = {i, i};
+    }
+    auto heavy = [](tecs::EntityHandle, Component1& c1, Component2& c2) {
+        for (int i = 0; i < 16; ++i) {
+            c1.x = (c1.x * 31 + c2.y) % 1000003;
+        }
+    };
+
+    Timer timer;
+    ecs.forEach<Component1, Component2>(heavy);
+    timer.stop("Whole pass over 1M entities");
+
+    tecs::IterationCursor cursor;
+    tecs::IterationBudget budget;
+    budget.time = std::chrono::microseconds(500);
+    u32 frames = 1;
+    timer.start();
+    while (!ecs.forEachBudgeted<Component1, Component2>(cursor, budget, heavy)) {
+        ++frames;
+    }
+    timer.stop("Pass over 1M entities in 0.5ms slices");
+    std::cout << "Slices: " << frames << std::endl;
+}
+
+TEST_CASE("Iterate over 1M entities with some disabled", "[Benchmark]")
+{
+    const auto entitiesCount = 1'000'000;
+    MemoryReadyEcs ecs(MEGABYTES(80), entitiesCount);
+    std::vector<tecs::EntityHandle> handles;
+    for (long i = 0; i < entitiesCount; ++i) {
+        tecs::EntityHandle entity = ecs.newEntity();
+        ecs.addComponent<Component1>(entity) = {i};
+        ecs.addComponent<Component2>(entity) = {i, i};
+        handles.push_back(entity);
+    }
+    auto update = [](tecs::EntityHandle, Component1& c1, Component2& c2) {
+        c2.x += c1.x;
+    };
+
+    Timer timer;
+    ecs.forEach<Component1, Component2>(update);
+    timer.stop("Iterate over 1M with 2 components, none disabled");
+
+    for (long i = 0; i < entitiesCount; i += 4) {
+        ecs.setEntityEnabled(handles[i], false);
+    }
+    timer.start();
+    ecs.forEach<Component1, Component2>(update);
+    timer.stop("Iterate over 1M with 2 components, a quarter disabled");
+}
+
+TEST_CASE("Instantiate 1M entities from a prefab", "[Benchmark]")
+{
+    const auto entitiesCount = 1'000'000;
+    MemoryReadyEcs serial(MEGABYTES(80), entitiesCount);
+    MemoryReadyEcs ecs(MEGABYTES(80), entitiesCount);
+
+    Timer timer;
+    for (long i = 0; i < entitiesCount; ++i) {
+        tecs::EntityHandle entity = serial.newEntity();
+        serial.addComponent<Component1>(entity) = {1};
+        serial.addComponent<Component2>(entity) = {2, 3};
+    }
+    timer.stop("Create 1M entities with 2 components one by one");
+
+    const tecs::Prefab prefab = ecs.definePrefab(Component1{1}, Component2{2, 3});
+    timer.start();
+    ecs.instantiate(prefab, entitiesCount);
+    timer.stop("Instantiate 1M entities from a prefab");
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component2>()) == entitiesCount);
+}
+
+TEST_CASE("Move 500k entities to another world", "[Benchmark]")
+{
+    const auto entitiesCount = 500'000;
+    MemoryReadyEcs source(MEGABYTES(80), entitiesCount);
+    MemoryReadyEcs serial(MEGABYTES(80), entitiesCount);
+    MemoryReadyEcs batched(MEGABYTES(80), entitiesCount);
+    std::vector<tecs::EntityHandle> entities(entitiesCount);
+    for (long i = 0; i < entitiesCount; ++i) {
+        entities[i] = source.newEntity();
+        source.addComponent<Component1>(entities[i]) = {1};
+        source.addComponent<Component2>(entities[i]) = {2, 3};
+    }
+    // The same entities in a second world, for the batched move
+    MemoryReadyEcs copy(MEGABYTES(80), entitiesCount);
+    for (long i = 0; i < entitiesCount; ++i) {
+        const tecs::EntityHandle entity = copy.newEntity();
+        copy.addComponent<Component1>(entity) = {1};
+        copy.addComponent<Component2>(entity) = {2, 3};
+    }
+
+    Timer timer;
+    for (tecs::EntityHandle entity : entities) {
+        source.moveEntity(entity, serial);
+    }
+    timer.stop("Move 500k entities with 2 components one by one");
+
+    std::vector<tecs::EntityHandle> moved(entitiesCount);
+    timer.start();
+    copy.moveEntities(entities.data(), entitiesCount, batched, moved.data());
+    timer.stop("Move 500k entities with 2 components in batches");
+    REQUIRE(batched.getComponentAmount(ComponentTypes::TypeId<Component2>()) == entitiesCount);
+}
+
+TEST_CASE("Merge a section of 100k entities into a world", "[Benchmark]")
+{
+    const auto entitiesCount = 100'000;
+    MemoryReadyEcs ecs(MEGABYTES(40), 2 * entitiesCount);
+    MemoryReadyEcs section(MEGABYTES(20), entitiesCount);
+    for (long i = 0; i < entitiesCount; ++i) {
+        tecs::EntityHandle entity = ecs.newEntity();
+        ecs.addComponent<Component1>(entity) = {1};
+        entity = section.newEntity();
+        section.addComponent<Component1>(entity) = {1};
+        section.addComponent<Component2>(entity) = {2, 3};
+    }
+
+    Timer timer;
+    const std::vector<tecs::EntityHandle> remap = ecs.merge(std::move(section));
+    timer.stop("Merge a section of 100k entities with 2 components");
+    REQUIRE(remap.size() == entitiesCount + 1);
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component1>()) == 2 * entitiesCount);
+}
+
+TEST_CASE("Unload a region of 100k entities", "[Benchmark]")
+{
+    const auto entitiesCount = 100'000;
+    MemoryReadyEcs ecs(MEGABYTES(60), 2 * entitiesCount + 1024);
+    const tecs::RegionHandle region = ecs.createRegion(MEGABYTES(20), entitiesCount);
+    std::vector<tecs::EntityHandle> entities(entitiesCount);
+    for (long i = 0; i < entitiesCount; ++i) {
+        entities[i] = ecs.newEntity();
+        ecs.addComponent<Component1>(entities[i]) = {1};
+        ecs.addComponent<Component2>(entities[i]) = {2, 3};
+        const tecs::EntityHandle entity = ecs.newEntity(region);
+        ecs.addComponent<Component1>(entity) = {1};
+        ecs.addComponent<Component2>(entity) = {2, 3};
+    }
+
+    Timer timer;
+    for (tecs::EntityHandle entity : entities) {
+        ecs.removeEntity(entity);
+    }
+    timer.stop("Destroy 100k entities with 2 components one by one");
+
+    timer.start();
+    ecs.unloadRegion(region);
+    timer.stop("Unload a region of 100k entities with 2 components");
+    REQUIRE(ecs.getEntityAmount() == 0);
+}
@@ -1,9 +1,14 @@
+#include <algorithm>
 #include <set>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "catch2/catch.hpp"
 
 #define TECS_CHECK(expr, message) INFO(message) REQUIRE(expr)
 #define TECS_ASSERT(expr, message) INFO(message) REQUIRE(expr)
+#define TECS_ACCESS_CHECKS 1
 
 #include <tecs/tecs.h>
 
@@ -176,8 +181,157 @@ TEST_CASE("Create entity starts with no components after reusing id",
     REQUIRE(ecs.entityHasComponent<Component1>(entity));
     ecs.removeEntity(entity);
 
+    EntityHandle previous = entity;
     entity = ecs.newEntity();
+    REQUIRE(entity.id == 1);
+    REQUIRE(entity.generation == 1);
+    REQUIRE(!ecs.isEntityHandleValid(previous));
     REQUIRE(!ecs.entityHasComponent<Component1>(entity));
+
+    // Next creations follow the free list, then new ids
+    ecs.removeEntity(entity);
+    REQUIRE(ecs.newEntity().id == 1);
+    REQUIRE(ecs.newEntity().id == 2);
+}
+
+TEST_CASE("Create and destroy entities from many threads", "[entity]")
+{
+    constexpr u32 threadCount = 4;
+    constexpr u32 perThread = 2000;
+    MemoryReadyEcs ecs(MEGABYTES(2), threadCount * perThread);
+
+    // Catch isn't thread safe, check the results after joining
+    std::vector<EntityHandle> created[threadCount];
+    auto createAll = [&](u32 count) {
+        std::vector<std::thread> threads;
+        for (u32 t = 0; t < threadCount; ++t) {
+            threads.emplace_back([&, t]() {
+                created[t].clear();
+                for (u32 i = 0; i < count; ++i) {
+                    created[t].push_back(ecs.newEntityConcurrent());
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    };
+
+    createAll(perThread);
+    std::set<u32> ids;
+    for (const auto& handles : created) {
+        for (EntityHandle e : handles) {
+            REQUIRE(ecs.isEntityHandleValid(e));
+            REQUIRE(ids.insert(e.id).second);
+        }
+    }
+    REQUIRE(ecs.getEntityAmount() == threadCount * perThread);
+    for (EntityHandle e : created[0]) {
+        ecs.addComponent<Component1>(e) = {long(e.id)};
+    }
+
+    // Every thread destroys all handles, only one wins each
+    u32 destroyed[threadCount] = {};
+    std::vector<std::thread> threads;
+    for (u32 t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t]() {
+            for (u32 i = 0; i < perThread; i += 2) {
+                destroyed[t] += ecs.destroyEntityConcurrent(created[0][i]);
+                destroyed[t] += ecs.destroyEntityConcurrent(created[1][i]);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    u32 destroyedCount = 0;
+    for (u32 count : destroyed) {
+        destroyedCount += count;
+    }
+    REQUIRE(destroyedCount == perThread);
+    REQUIRE(!ecs.isEntityHandleValid(created[0][0]));
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component1>()) == perThread);
+
+    ecs.collectDestroyedEntities();
+    REQUIRE(ecs.getEntityAmount() == (threadCount - 1) * perThread);
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component1>()) == perThread / 2);
+
+    // The freed ids are reused, there are no fresh ones left
+    createAll(perThread / threadCount);
+    u32 reused = 0;
+    for (const auto& handles : created) {
+        for (EntityHandle e : handles) {
+            REQUIRE(ecs.isEntityHandleValid(e));
+            REQUIRE(!ecs.entityHasComponent<Component1>(e));
+            reused += e.generation == 1;
+        }
+    }
+    REQUIRE(reused == perThread);
+}
+
+TEST_CASE("Components staged by many threads are merged", "[component]")
+{
+    constexpr u32 threadCount = 4;
+    constexpr u32 perThread = 1500;
+    MemoryReadyEcs ecs(MEGABYTES(4), threadCount * perThread + 1);
+    std::unique_ptr<char[]> stagingMemory(new char[MEGABYTES(1)]);
+    ArenaAllocator stagingArena(stagingMemory.get(), MEGABYTES(1));
+
+    const EntityHandle existing = ecs.newEntity();
+    ecs.addComponent<Component2>(existing) = {-1, -1};
+
+    ComponentStaging<Component2> stagings[threadCount];
+    for (u32 t = 0; t < threadCount; ++t) {
+        stagings[t] = ComponentStaging<Component2>(stagingArena, perThread);
+    }
+    std::vector<std::thread> threads;
+    for (u32 t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t]() {
+            for (u32 i = 0; i < perThread; ++i) {
+                const EntityHandle e = ecs.newEntityConcurrent();
+                stagings[t].add(e) = {long(e.id), long(t)};
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    ecs.prepareStaged(stagings, threadCount);
+    threads.clear();
+    for (u32 t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t]() { ecs.mergeStaged(stagings[t]); });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component2>()) ==
+            threadCount * perThread + 1);
+    for (u32 t = 0; t < threadCount; ++t) {
+        for (u32 i = 0; i < perThread; ++i) {
+            const EntityHandle e = stagings[t].entities()[i];
+            Component2* c = ecs.getComponent<Component2>(e);
+            REQUIRE(c != nullptr);
+            REQUIRE(c->x == long(e.id));
+            REQUIRE(c->y == long(t));
+        }
+    }
+    REQUIRE(ecs.getComponent<Component2>(existing)->x == -1);
+
+    u32 visited = 0;
+    ecs.forEach<Component2>([&](EntityHandle e, Component2& c) {
+        REQUIRE(c.x == (e.id == existing.id ? -1 : long(e.id)));
+        ++visited;
+    });
+    REQUIRE(visited == threadCount * perThread + 1);
+
+    // The container keeps working as usual afterwards
+    const EntityHandle removed = stagings[2].entities()[7];
+    ecs.removeComponent<Component2>(removed);
+    REQUIRE(ecs.getComponent<Component2>(removed) == nullptr);
+    ecs.addComponent<Component2>(removed) = {7, 7};
+    REQUIRE(ecs.getComponent<Component2>(removed)->x == 7);
 }
 
 TEST_CASE("Create many entities with one component", "[entity component]")
@@ -422,4 +576,1428 @@ TEST_CASE("Destroyed entity must have it's components invalidated",
         REQUIRE(!ecs.entityHasComponent<Component1>(e));
         REQUIRE(!ecs.entityHasComponent<Component2>(e));
     }
-}
\ No newline at end of file
+}
+TEST_CASE("Removed components are recycled without aliasing live ones",
+          "[entity components]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(1), 1000);
+
+    EntityHandle handles[100];
+    for (int i = 0; i < 100; ++i) {
+        handles[i] = ecs.newEntity();
+        ecs.addComponent<Component1>(handles[i]) = {i};
+    }
+    for (int i = 0; i < 100; i += 2) {
+        ecs.removeComponent<Component1>(handles[i]);
+    }
+    for (int i = 0; i < 100; i += 2) {
+        ecs.addComponent<Component1>(handles[i]) = {i + 1000};
+    }
+
+    std::set<void*> seen;
+    for (int i = 0; i < 100; ++i) {
+        Component1* c1 = ecs.getComponent<Component1>(handles[i]);
+        REQUIRE(c1 != nullptr);
+        REQUIRE(seen.insert(c1).second == true);
+        REQUIRE(c1->x == ((i % 2) == 0 ? i + 1000 : i));
+    }
+
+    int timesCalled = 0;
+    ecs.forEach<Component1>([&](EntityHandle e, Component1& c1) {
+        REQUIRE(ecs.getComponent<Component1>(e) == &c1);
+        ++timesCalled;
+    });
+    REQUIRE(timesCalled == 100);
+}
+
+TEST_CASE("Every query strategy visits the same entities",
+          "[entity loop]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(4), 20'000);
+
+    std::vector<EntityHandle> handles;
+    for (int i = 0; i < 20'000; ++i) {
+        EntityHandle e = ecs.newEntity();
+        handles.push_back(e);
+        if ((i % 3) != 0) {
+            ecs.addComponent<Component1>(e) = {i};
+        }
+        if ((i % 5) != 0 && (i < 4000 || i > 12'000)) {
+            ecs.addComponent<Component2>(e) = {i, i * 2};
+        }
+    }
+    // Empty out some bitset blocks and punch holes in others
+    for (int i = 12'000; i < 16'000; ++i) {
+        ecs.removeComponent<Component2>(handles[i]);
+    }
+    for (int i = 0; i < 20'000; i += 7) {
+        ecs.removeComponent<Component1>(handles[i]);
+    }
+
+    auto collect = [&](QueryStrategy strategy) {
+        std::set<u32> seen;
+        ecs.forEach<Component1, Component2>(
+            strategy, [&](EntityHandle e, Component1& c1, Component2& c2) {
+                REQUIRE(c1.x == e.id - 1);
+                REQUIRE(c2.y == c1.x * 2);
+                REQUIRE(seen.insert(e.id).second == true);
+            });
+        return seen;
+    };
+
+    std::set<u32> probed = collect(QueryStrategy::ProbeJoin);
+    std::set<u32> prefetched = collect(QueryStrategy::PrefetchedProbeJoin);
+    std::set<u32> intersected = collect(QueryStrategy::BitsetIntersection);
+    REQUIRE(!probed.empty());
+    REQUIRE(probed == prefetched);
+    REQUIRE(probed == intersected);
+
+    u32 expected = 0;
+    for (int i = 0; i < 20'000; ++i) {
+        if (ecs.entityHasComponent<Component1>(handles[i]) &&
+            ecs.entityHasComponent<Component2>(handles[i])) {
+            ++expected;
+        }
+    }
+    REQUIRE(probed.size() == expected);
+}
+
+TEST_CASE("Query planner picks strategy and probe order from container stats",
+          "[query plan]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(8), 50'000);
+
+    for (int i = 0; i < 50'000; ++i) {
+        EntityHandle e = ecs.newEntity();
+        ecs.addComponent<Component1>(e) = {i};
+        if ((i % 2) == 0) {
+            ecs.addComponent<Component2>(e) = {i, i};
+        }
+        if (i % 10'000 == 0) {
+            ecs.addComponent<Component3>(e) = {i, i, i};
+        }
+    }
+
+    ContainerStats stats = ecs.getContainerStats(ComponentTypes::TypeId<Component2>());
+    REQUIRE(stats.count == 25'000);
+    REQUIRE(stats.occupiedBlocks == 50'001 / BitsetBlockEntities + 1);
+
+    SECTION("Large joins do not probe")
+    {
+        auto plan = ecs.planQuery<Component1, Component2>();
+        REQUIRE(plan.strategy != QueryStrategy::ProbeJoin);
+        REQUIRE(plan.drivingType == ComponentTypes::TypeId<Component2>());
+    }
+
+    SECTION("Tiny driver probes, most selective container first")
+    {
+        auto plan = ecs.planQuery<Component1, Component3, Component2>();
+        REQUIRE(plan.strategy == QueryStrategy::ProbeJoin);
+        REQUIRE(plan.drivingType == ComponentTypes::TypeId<Component3>());
+        REQUIRE(plan.probeTypes[0] == ComponentTypes::TypeId<Component2>());
+        REQUIRE(plan.probeTypes[1] == ComponentTypes::TypeId<Component1>());
+
+        int timesCalled = 0;
+        ecs.forEach<Component1, Component3, Component2>(
+            [&](EntityHandle e, Component1& c1, Component3& c3, Component2& c2) {
+                REQUIRE(c1.x == c3.x);
+                REQUIRE(c2.x == c3.x);
+                ++timesCalled;
+            });
+        REQUIRE(timesCalled == 5);
+    }
+
+    SECTION("Explicit strategy is kept")
+    {
+        auto plan = ecs.planQuery<Component1, Component2>(QueryStrategy::ProbeJoin);
+        REQUIRE(plan.strategy == QueryStrategy::ProbeJoin);
+    }
+}
+
+TEST_CASE("Merge join over containers sorted by entity", "[query plan]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(8), 20'000);
+
+    std::vector<EntityHandle> handles;
+    for (int i = 0; i < 20'000; ++i) {
+        EntityHandle e = ecs.newEntity();
+        handles.push_back(e);
+        if ((i % 3) != 0) {
+            ecs.addComponent<Component1>(e) = {i};
+        }
+        if ((i % 5) != 0) {
+            ecs.addComponent<Component2>(e) = {i, i * 2};
+        }
+    }
+    REQUIRE(ecs.getContainerStats(ComponentTypes::TypeId<Component1>()).sortedByEntity);
+    REQUIRE(ecs.planQuery<Component1, Component2>().strategy == QueryStrategy::MergeJoin);
+
+    // Recycling a handle out of order breaks the order
+    for (int i = 100; i < 200; ++i) {
+        ecs.removeComponent<Component1>(handles[i]);
+    }
+    REQUIRE(ecs.getContainerStats(ComponentTypes::TypeId<Component1>()).sortedByEntity);
+    ecs.addComponent<Component1>(handles[19'999]);
+    for (int i = 100; i < 200; i += 2) {
+        ecs.addComponent<Component1>(handles[i]) = {i};
+    }
+    REQUIRE(!ecs.getContainerStats(ComponentTypes::TypeId<Component1>()).sortedByEntity);
+    REQUIRE(ecs.planQuery<Component1, Component2>(QueryStrategy::MergeJoin).strategy !=
+            QueryStrategy::MergeJoin);
+
+    auto collect = [&](QueryStrategy strategy) {
+        std::vector<u32> seen;
+        ecs.forEach<Component1, Component2>(
+            strategy, [&](EntityHandle e, Component1& c1, Component2& c2) {
+                REQUIRE(c1.x == e.id - 1);
+                REQUIRE(c2.y == c1.x * 2);
+                seen.push_back(e.id);
+            });
+        return seen;
+    };
+    std::vector<u32> probed = collect(QueryStrategy::ProbeJoin);
+
+    ecs.sortByEntity<Component1>();
+    ContainerStats stats = ecs.getContainerStats(ComponentTypes::TypeId<Component1>());
+    REQUIRE(stats.sortedByEntity);
+    REQUIRE(stats.slots == stats.count);
+
+    std::vector<u32> merged = collect(QueryStrategy::MergeJoin);
+    REQUIRE(std::is_sorted(merged.begin(), merged.end()));
+    std::sort(probed.begin(), probed.end());
+    REQUIRE(probed == merged);
+
+    // Sparse ids follow the moved components
+    for (int i = 0; i < 20'000; ++i) {
+        Component1* c1 = ecs.getComponent<Component1>(handles[i]);
+        if (c1 != nullptr) {
+            REQUIRE(c1->x == i);
+        }
+    }
+}
+
+TEST_CASE("Sort component container with a comparator", "[sort]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(1), 1000);
+
+    std::vector<EntityHandle> handles;
+    for (int i = 0; i < 1000; ++i) {
+        EntityHandle e = ecs.newEntity();
+        handles.push_back(e);
+        ecs.addComponent<Component1>(e) = {(i * 37) % 1000};
+        if ((i % 3) != 0) {
+            ecs.addComponent<Component2>(e) = {(i * 37) % 1000, i};
+        }
+    }
+    for (int i = 0; i < 1000; i += 10) {
+        ecs.removeComponent<Component1>(handles[i]);
+    }
+
+    ecs.sort<Component1, Component2>(
+        [](const Component1& a, const Component1& b) { return a.x > b.x; });
+
+    std::vector<u32> order;
+    long previous = 1000;
+    ecs.forEach<Component1>([&](EntityHandle e, Component1& c1) {
+        REQUIRE(c1.x < previous);
+        REQUIRE(ecs.getComponent<Component1>(e) == &c1);
+        previous = c1.x;
+        order.push_back(e.id);
+    });
+    REQUIRE(order.size() == 900);
+
+    SECTION("Paired container follows the same order")
+    {
+        std::vector<u32> pairedOrder;
+        ecs.forEach<Component2>([&](EntityHandle e, Component2& c2) {
+            REQUIRE(ecs.getComponent<Component2>(e) == &c2);
+            REQUIRE(c2.y == e.id - 1);
+            pairedOrder.push_back(e.id);
+        });
+        REQUIRE(pairedOrder.size() == 666);
+
+        std::vector<u32> expected;
+        for (u32 id : order) {
+            if (ecs.entityHasComponent<Component2>(handles[id - 1])) {
+                expected.push_back(id);
+            }
+        }
+        pairedOrder.resize(expected.size());
+        REQUIRE(pairedOrder == expected);
+    }
+
+    SECTION("Sorted containers keep working after more changes")
+    {
+        ecs.removeComponent<Component1>(handles[1]);
+        ecs.addComponent<Component1>(handles[0]) = {5000};
+        REQUIRE(ecs.getComponent<Component1>(handles[0])->x == 5000);
+        REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component1>()) == 900);
+    }
+}
+
+TEST_CASE("Relocated copy of the world is independent", "[arena]")
+{
+    REQUIRE(std::is_trivially_copyable<EntitySystem>::value);
+
+    MemoryReadyEcs ecs(MEGABYTES(1), 1000);
+    std::vector<EntityHandle> handles;
+    for (int i = 0; i < 1000; ++i) {
+        EntityHandle e = ecs.newEntity();
+        handles.push_back(e);
+        ecs.addComponent<Component1>(e) = {i};
+        if ((i % 2) == 0) {
+            ecs.addComponent<Component2>(e) = {i, -i};
+        }
+    }
+
+    const u32 used = ecs.arena().usedSize();
+    std::unique_ptr<char[]> copyMemory = std::make_unique<char[]>(used);
+    std::memcpy(copyMemory.get(), ecs.arena().memory(), used);
+    EntitySystem copy = ecs;
+    copy.rebind(copyMemory.get(), used);
+
+    // Original memory goes away, the copy must not reference it
+    std::memset(ecs.memory.get(), 0xff, used);
+
+    u32 count = 0;
+    copy.forEach<Component1, Component2>(
+        [&](EntityHandle e, Component1& c1, Component2& c2) {
+            REQUIRE(c1.x == e.id - 1);
+            REQUIRE(c2.y == -c1.x);
+            REQUIRE((char*)&c1 >= copyMemory.get());
+            REQUIRE((char*)&c1 < copyMemory.get() + used);
+            ++count;
+        });
+    REQUIRE(count == 500);
+    REQUIRE(copy.getComponent<Component2>(handles[1]) == nullptr);
+    REQUIRE(copy.getComponent<Component1>(handles[999])->x == 999);
+}
+
+TEST_CASE("Arena allocations are aligned and refuse to overflow", "[arena]")
+{
+    alignas(16) char memory[64];
+    ArenaAllocator arena(memory, sizeof(memory));
+    REQUIRE(arena.allocOffset<char>(3) == 0);
+    REQUIRE(arena.allocOffset<std::uint32_t>(1) == 8);
+    REQUIRE(arena.allocOffset<std::uint8_t>(1) == 16);
+    REQUIRE(arena.allocOffset<std::uint64_t>(2) == 24);
+    REQUIRE(arena.usedSize() == 40);
+
+    REQUIRE_THROWS(arena.allocOffset<char>(25));
+    REQUIRE(arena.usedSize() == 40);
+    // A size that wraps 32 bits is not taken for a small one
+    REQUIRE_THROWS(arena.allocOffset<std::uint64_t>(u32(1) << 29));
+    REQUIRE(arena.allocOffset<char>(24) == 40);
+}
+
+CREATE_COMPONENT_TYPES(ResizedComponentTypes);
+REGISTER_COMPONENT_TYPE(ResizedComponentTypes, Component3, 1);
+
+TEST_CASE("Snapshot saved to a file loads into a working world", "[snapshot]")
+{
+    const char* path = "tecs_snapshot_test.bin";
+    std::vector<EntityHandle> handles;
+    {
+        MemoryReadyEcs ecs(MEGABYTES(1), 1000);
+        for (int i = 0; i < 1000; ++i) {
+            EntityHandle e = ecs.newEntity();
+            handles.push_back(e);
+            ecs.addComponent<Component1>(e) = {i};
+            if ((i % 4) == 0) {
+                ecs.addComponent<Component2>(e) = {i, 2 * i};
+            }
+        }
+        REQUIRE(ecs.saveSnapshot(path));
+    }
+
+    SECTION("Loaded world serves queries and keeps growing")
+    {
+        EntitySystem loaded;
+        SnapshotMapping mapping = loaded.loadSnapshot<Component1, Component2>(path);
+        REQUIRE(mapping);
+
+        u32 count = 0;
+        loaded.forEach<Component1, Component2>(
+            [&](EntityHandle e, Component1& c1, Component2& c2) {
+                REQUIRE(c1.x == e.id - 1);
+                REQUIRE(c2.y == 2 * c1.x);
+                ++count;
+            });
+        REQUIRE(count == 250);
+        REQUIRE(loaded.getComponent<Component2>(handles[1]) == nullptr);
+
+        loaded.addComponent<Component2>(handles[1]) = {1, 2};
+        loaded.addComponent<Component3>(handles[2]) = {1, 2, 3};
+        REQUIRE(loaded.getComponent<Component2>(handles[1])->y == 2);
+        REQUIRE(loaded.getComponent<Component3>(handles[2])->z == 3);
+    }
+
+    SECTION("Incompatible snapshots are rejected")
+    {
+        Ecs<ComponentTypes, 32> fewerComponents;
+        REQUIRE_FALSE(fewerComponents.loadSnapshot(path));
+
+        Ecs<ResizedComponentTypes, 64> resized;
+        REQUIRE_FALSE(resized.loadSnapshot<Component3>(path));
+
+        std::FILE* file = std::fopen(path, "r+b");
+        const std::uint32_t version = SnapshotVersion + 1;
+        std::fseek(file, offsetof(SnapshotHeader, version), SEEK_SET);
+        std::fwrite(&version, sizeof(version), 1, file);
+        std::fclose(file);
+        EntitySystem loaded;
+        REQUIRE_FALSE(loaded.loadSnapshot(path));
+    }
+
+    std::remove(path);
+}
+
+EntitySystem copyWorld(const EntitySystem& world, std::unique_ptr<char[]>& memory)
+{
+    const u32 size = world.arena().size();
+    memory = std::make_unique<char[]>(size);
+    std::memcpy(memory.get(), world.arena().memory(), world.arena().usedSize());
+    EntitySystem copy = world;
+    copy.rebind(memory.get(), size);
+    return copy;
+}
+
+TEST_CASE("Delta brings a copy of the baseline to the current state", "[delta]")
+{
+    MemoryReadyEcs server(MEGABYTES(1), 1000);
+    std::vector<EntityHandle> handles;
+    for (int i = 0; i < 500; ++i) {
+        EntityHandle e = server.newEntity();
+        handles.push_back(e);
+        server.addComponent<Component1>(e) = {i};
+        server.addComponent<Component2>(e) = {i, i};
+    }
+
+    std::unique_ptr<char[]> baselineMemory;
+    std::unique_ptr<char[]> clientMemory;
+    EntitySystem baseline = copyWorld(server, baselineMemory);
+    EntitySystem client = copyWorld(server, clientMemory);
+
+    for (int i = 0; i < 500; i += 7) {
+        server.getComponent<Component1>(handles[i])->x = -i;
+    }
+    server.removeComponent<Component2>(handles[3]);
+    server.removeEntity(handles[4]);
+    EntityHandle created = server.newEntity();
+    server.addComponent<Component3>(created) = {1, 2, 3};
+    server.addComponent<Component3>(handles[5]) = {4, 5, 6};
+
+    std::vector<char> delta(MEGABYTES(1));
+    const u32 size = server.encodeDelta(baseline, delta.data(), delta.size());
+    REQUIRE(size > 0);
+    REQUIRE(size < server.arena().usedSize() / 2);
+    REQUIRE(server.encodeDelta(baseline, delta.data(), size - 1) == 0);
+
+    REQUIRE(client.applyDelta(delta.data(), size));
+    REQUIRE(client.arena().usedSize() == server.arena().usedSize());
+    REQUIRE(std::memcmp(client.arena().memory(), server.arena().memory(),
+                        server.arena().usedSize()) == 0);
+
+    REQUIRE(client.getComponent<Component1>(handles[7])->x == -7);
+    REQUIRE(client.getComponent<Component2>(handles[3]) == nullptr);
+    REQUIRE_FALSE(client.isEntityHandleValid(handles[4]));
+    REQUIRE(client.isEntityHandleValid(created));
+    REQUIRE(client.getComponent<Component3>(created)->z == 3);
+    REQUIRE(client.getComponent<Component3>(handles[5])->x == 4);
+
+    // The client is no longer at the baseline of the delta
+    REQUIRE_FALSE(client.applyDelta(delta.data(), size));
+    REQUIRE_FALSE(baseline.applyDelta(delta.data(), size - 1));
+}
+
+TEST_CASE("Snapshot ring restores earlier frames", "[snapshot]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(1), 1000);
+    std::vector<EntityHandle> handles;
+    for (int i = 0; i < 1000; ++i) {
+        EntityHandle e = ecs.newEntity();
+        handles.push_back(e);
+        ecs.addComponent<Component1>(e) = {i};
+        ecs.addComponent<Component2>(e) = {i, i};
+    }
+
+    std::unique_ptr<char[]> ringMemory = std::make_unique<char[]>(MEGABYTES(4));
+    SnapshotRing<EntitySystem, 4> ring(ringMemory.get(), MEGABYTES(4));
+
+    // Full copies of every frame to compare with
+    std::vector<std::unique_ptr<char[]>> expectedMemory(20);
+    std::vector<EntitySystem> expected;
+    auto simulate = [&](int frame) {
+        ecs.forEach<Component1>([&](EntityHandle, Component1& c1) { c1.x += 1; });
+        ecs.getComponent<Component2>(handles[500 + frame])->y = -frame;
+        if ((frame % 3) == 0) {
+            ecs.addComponent<Component3>(handles[frame * 10]) = {frame, frame, frame};
+            ecs.removeComponent<Component2>(handles[frame * 10 + 1]);
+        }
+        ring.save(ecs);
+        expected.push_back(copyWorld(ecs, expectedMemory[frame]));
+    };
+    auto requireFrame = [&](int frame) {
+        REQUIRE(ecs.arena().usedSize() == expected[frame].arena().usedSize());
+        REQUIRE(std::memcmp(ecs.arena().memory(), expected[frame].arena().memory(),
+                            ecs.arena().usedSize()) == 0);
+    };
+
+    for (int frame = 0; frame < 10; ++frame) {
+        simulate(frame);
+    }
+    REQUIRE(ring.frames() == 4);
+
+    ring.restore(ecs, 0);
+    requireFrame(9);
+    ring.restore(ecs, 2);
+    requireFrame(7);
+    REQUIRE(ring.frames() == 2);
+    REQUIRE(ecs.getComponent<Component1>(handles[0])->x == 8);
+
+    // Simulating again replaces the dropped frames
+    expected.resize(8);
+    for (int frame = 8; frame < 14; ++frame) {
+        simulate(frame);
+    }
+    ring.restore(ecs, 3);
+    requireFrame(10);
+    REQUIRE(ecs.getComponent<Component3>(handles[90])->x == 9);
+    REQUIRE(ecs.getComponent<Component2>(handles[91]) == nullptr);
+}
+
+TEST_CASE("Forked world changes stay in the fork", "[fork]")
+{
+    ForkableMemory memory;
+    REQUIRE(memory.create(MEGABYTES(1)));
+    EntitySystem ecs(ArenaAllocator(memory.data(), memory.size()), 2000);
+    std::vector<EntityHandle> handles;
+    for (int i = 0; i < 1000; ++i) {
+        EntityHandle e = ecs.newEntity();
+        handles.push_back(e);
+        ecs.addComponent<Component1>(e) = {i};
+    }
+
+    EntitySystem fork;
+    SnapshotMapping forkMemory = ecs.forkInto(fork, memory);
+    REQUIRE(forkMemory);
+    EntitySystem otherFork;
+    SnapshotMapping otherForkMemory = ecs.forkInto(otherFork, memory);
+    REQUIRE(otherForkMemory);
+
+    fork.forEach<Component1>([](EntityHandle, Component1& c1) { c1.x = -c1.x; });
+    EntityHandle created = fork.newEntity();
+    fork.addComponent<Component2>(created) = {1, 2};
+    fork.removeEntity(handles[10]);
+
+    REQUIRE(fork.getComponent<Component1>(handles[5])->x == -5);
+    REQUIRE(fork.getComponent<Component2>(created)->y == 2);
+    REQUIRE_FALSE(fork.isEntityHandleValid(handles[10]));
+
+    for (EntitySystem* world : {(EntitySystem*)&ecs, &otherFork}) {
+        REQUIRE(world->getComponent<Component1>(handles[5])->x == 5);
+        REQUIRE(world->isEntityHandleValid(handles[10]));
+        REQUIRE(world->getComponentAmount(ComponentTypes::TypeId<Component2>()) == 0);
+    }
+}
+
+TEST_CASE("View reads a shared world and detects torn frames", "[shared]")
+{
+    const std::string name = "/tecs-test-" + std::to_string(::getpid());
+    SharedWorld<EntitySystem> shared;
+    REQUIRE(shared.create(name.c_str(), MEGABYTES(1), 1000));
+    // A live segment is never taken over by accident
+    SharedWorld<EntitySystem> other;
+    REQUIRE(!other.create(name.c_str(), MEGABYTES(1), 1000));
+
+    EcsView<EntitySystem> view;
+    REQUIRE(view.attach(name.c_str()));
+    REQUIRE(view.forEach<Component1>([](EntityHandle, const Component1&) { FAIL(); }));
+
+    shared.beginFrame();
+    EntitySystem& world = shared.world();
+    for (int i = 0; i < 100; ++i) {
+        EntityHandle e = world.newEntity();
+        world.addComponent<Component1>(e) = {i};
+        if ((i % 2) == 0) {
+            world.addComponent<Component2>(e) = {i, i};
+        }
+    }
+    REQUIRE_FALSE(view.forEach<Component1>([](EntityHandle, const Component1&) {}));
+    shared.endFrame();
+    REQUIRE(view.frame() == 1);
+
+    long sum = 0;
+    REQUIRE(view.forEach<Component1, Component2>(
+        [&](EntityHandle e, const Component1& c1, const Component2& c2) {
+            REQUIRE(c1.x == e.id - 1);
+            REQUIRE(c2.y == c1.x);
+            sum += c1.x;
+        }));
+    REQUIRE(sum == 2450);
+
+    // A frame published while the view is querying tears it
+    bool first = true;
+    REQUIRE_FALSE(view.forEach<Component1>([&](EntityHandle, const Component1&) {
+        if (first) {
+            shared.beginFrame();
+            shared.world().forEach<Component1>([](EntityHandle, Component1& c1) { c1.x = -1; });
+            shared.endFrame();
+            first = false;
+        }
+    }));
+    REQUIRE(view.forEach<Component1>([](EntityHandle, const Component1& c1) {
+        REQUIRE(c1.x == -1);
+    }));
+}
+
+TEST_CASE("Journal replayed over a snapshot rebuilds the world", "[journal]")
+{
+    const char* path = "tecs_journal_test.bin";
+    std::FILE* file = std::fopen(path, "w+b");
+    REQUIRE(file != nullptr);
+
+    MemoryReadyEcs ecs(MEGABYTES(1), 1000);
+    ecs.enableJournal(4096);
+    std::vector<EntityHandle> handles;
+    for (int i = 0; i < 100; ++i) {
+        EntityHandle e = ecs.newEntity();
+        handles.push_back(e);
+        ecs.addComponent<Component1>(e) = {i};
+    }
+    REQUIRE(ecs.flushJournal(file));
+
+    std::unique_ptr<char[]> snapshotMemory;
+    EntitySystem replayed = copyWorld(ecs, snapshotMemory);
+
+    // Changes after the snapshot, flushed in batches
+    for (int i = 0; i < 100; i += 10) {
+        ecs.removeEntity(handles[i]);
+        ecs.removeComponent<Component1>(handles[i + 1]);
+        ecs.addComponent<Component2>(handles[i + 2]) = {i, -i};
+        ecs.journalWrite<Component2>(handles[i + 2]);
+    }
+    REQUIRE(ecs.flushJournal(file));
+    EntityHandle created = ecs.newEntity();
+    ecs.addComponent<Component3>(created) = {1, 2, 3};
+    ecs.journalWrite<Component3>(created);
+    ecs.addComponent<Component1>(ecs.newEntity());
+    REQUIRE(ecs.flushJournal(file));
+
+    // The whole journal rebuilds the world from scratch
+    std::fseek(file, 0, SEEK_SET);
+    MemoryReadyEcs rebuilt(MEGABYTES(1), 1000);
+    REQUIRE(rebuilt.replayJournal(file));
+    REQUIRE(rebuilt.getComponent<Component3>(created)->z == 3);
+
+    // Records since the snapshot only apply over it
+    const long snapshotPosition = 100 * 2 * sizeof(JournalRecord);
+    std::fseek(file, snapshotPosition, SEEK_SET);
+    MemoryReadyEcs empty(MEGABYTES(1), 1000);
+    REQUIRE_FALSE(empty.replayJournal(file));
+    std::fseek(file, snapshotPosition, SEEK_SET);
+    REQUIRE(replayed.replayJournal(file));
+    std::fclose(file);
+    std::remove(path);
+
+    for (int i = 0; i < 100; i += 10) {
+        REQUIRE(replayed.isEntityHandleValid(handles[i]) == ecs.isEntityHandleValid(handles[i]));
+        REQUIRE(replayed.getComponent<Component1>(handles[i + 1]) == nullptr);
+        REQUIRE(replayed.getComponent<Component2>(handles[i + 2])->y == -i);
+    }
+    REQUIRE(replayed.getComponent<Component3>(created)->z == 3);
+    for (u32 type = 1; type <= 3; ++type) {
+        REQUIRE(replayed.getComponentAmount(type) == ecs.getComponentAmount(type));
+    }
+
+    SECTION("Full journal reports lost records")
+    {
+        MemoryReadyEcs small(MEGABYTES(1), 1000);
+        small.enableJournal(sizeof(JournalRecord) * 4);
+        for (int i = 0; i < 5; ++i) {
+            small.newEntity();
+        }
+        std::FILE* sink = std::fopen(path, "w+b");
+        REQUIRE_FALSE(small.flushJournal(sink));
+        small.newEntity();
+        REQUIRE(small.flushJournal(sink));
+
+        // Replay stops where records were lost
+        std::fseek(sink, 0, SEEK_SET);
+        MemoryReadyEcs partial(MEGABYTES(1), 1000);
+        REQUIRE_FALSE(partial.replayJournal(sink));
+        REQUIRE(partial.getEntityAmount() == 4);
+        std::fclose(sink);
+        std::remove(path);
+    }
+
+    SECTION("Concurrent creation is not recorded")
+    {
+        MemoryReadyEcs concurrent(MEGABYTES(1), 1000);
+        concurrent.enableJournal(4096);
+        concurrent.newEntity();
+        concurrent.newEntityConcurrent();
+        concurrent.newEntity();
+        std::FILE* sink = std::fopen(path, "w+b");
+        REQUIRE_FALSE(concurrent.flushJournal(sink));
+        std::fseek(sink, 0, SEEK_SET);
+        MemoryReadyEcs partial(MEGABYTES(1), 1000);
+        REQUIRE_FALSE(partial.replayJournal(sink));
+        std::fclose(sink);
+        std::remove(path);
+    }
+}
+
+TEST_CASE("Export a component container as columns", "[export]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(1), 1000);
+    std::vector<EntityHandle> handles;
+    for (int i = 0; i < 1000; ++i) {
+        EntityHandle e = ecs.newEntity();
+        handles.push_back(e);
+        ecs.addComponent<Component2>(e) = {i, -i};
+    }
+    for (int i = 0; i < 1000; i += 3) {
+        ecs.removeComponent<Component2>(handles[i]);
+    }
+
+    // Reads the columns back, checking each row against its entity
+    auto readColumns = [](std::FILE* file, std::vector<ColumnDescriptor>& columns) {
+        ColumnsHeader header;
+        std::fseek(file, 0, SEEK_SET);
+        REQUIRE(std::fread(&header, sizeof(header), 1, file) == 1);
+        REQUIRE(header.magic == ColumnsMagic);
+        REQUIRE(header.componentSize == sizeof(Component2));
+        columns.resize(header.columnCount);
+        REQUIRE(std::fread(columns.data(), sizeof(ColumnDescriptor), columns.size(), file) ==
+                columns.size());
+
+        u32 rows = 0;
+        std::uint32_t groupRows;
+        while (std::fread(&groupRows, sizeof(groupRows), 1, file) == 1) {
+            std::vector<std::uint32_t> ids(groupRows);
+            REQUIRE(std::fread(ids.data(), sizeof(std::uint32_t), groupRows, file) == groupRows);
+            for (const ColumnDescriptor& column : columns) {
+                std::vector<char> values(groupRows * column.size);
+                REQUIRE(std::fread(values.data(), 1, values.size(), file) == values.size());
+                for (u32 row = 0; row < groupRows; ++row) {
+                    const long x = ids[row] - 1;
+                    Component2 expected = {x, -x};
+                    REQUIRE(std::memcmp(values.data() + row * column.size,
+                                        (char*)&expected + column.offset, column.size) == 0);
+                }
+            }
+            rows += groupRows;
+        }
+        REQUIRE(rows == header.rowCount);
+        REQUIRE(rows == 666);
+    };
+
+    std::FILE* file = std::tmpfile();
+    std::vector<ColumnDescriptor> columns;
+
+    SECTION("One column per field")
+    {
+        const FieldDescriptor fields[] = {TECS_FIELD(Component2, x), TECS_FIELD(Component2, y)};
+        REQUIRE(ecs.exportColumns<Component2>(file, fields, 2));
+        readColumns(file, columns);
+        REQUIRE(columns.size() == 2);
+        REQUIRE(std::string(columns[1].name) == "y");
+        REQUIRE(columns[1].offset == offsetof(Component2, y));
+    }
+
+    SECTION("Whole components")
+    {
+        REQUIRE(ecs.exportColumns<Component2>(file));
+        readColumns(file, columns);
+        REQUIRE(columns.size() == 1);
+        REQUIRE(columns[0].size == sizeof(Component2));
+    }
+
+    std::fclose(file);
+}
+
+TEST_CASE("Scheduler runs conflicting systems in order", "[scheduler]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(1), 1000);
+    for (u32 i = 0; i < 1000; ++i) {
+        const EntityHandle e = ecs.newEntity();
+        ecs.addComponent<Component1>(e) = {0};
+        ecs.addComponent<Component2>(e) = {0, 0};
+        ecs.addComponent<Component3>(e) = {0, 0, 0};
+    }
+
+    SystemScheduler<EntitySystem> scheduler(3);
+    scheduler.addSystem<Write<Component1>>([](EntitySystem& world) {
+        world.forEach<Component1>([](EntityHandle, Component1& c1) { ++c1.x; });
+    });
+    scheduler.addSystem<Read<Component1>, Write<Component2>>([](EntitySystem& world) {
+        world.forEach<Component1, Component2>(
+            [](EntityHandle, Component1& c1, Component2& c2) { c2.x = c1.x; });
+    });
+    scheduler.addSystem<Write<Component3>>([](EntitySystem& world) {
+        world.forEach<Component3>([](EntityHandle, Component3& c3) { ++c3.z; });
+    });
+    std::atomic<long> readSum{0};
+    scheduler.addSystem<Read<Component1>>([&](EntitySystem& world) {
+        long sum = 0;
+        world.forEach<Component1>([&](EntityHandle, Component1& c1) { sum += c1.x; });
+        readSum += sum;
+    });
+    scheduler.addSystem<Read<Component2>, Write<Component1>>([](EntitySystem& world) {
+        world.forEach<Component1, Component2>(
+            [](EntityHandle, Component1& c1, Component2& c2) { c1.x = c2.x * 2; });
+    });
+
+    REQUIRE(scheduler.dependencies(0) == 0);
+    REQUIRE(scheduler.dependencies(1) == 1);
+    REQUIRE(scheduler.dependencies(2) == 0);
+    REQUIRE(scheduler.dependencies(3) == 1);
+    REQUIRE(scheduler.dependencies(4) == 3);
+
+    // c1 goes 0 -> 1 -> 2, 2 -> 3 -> 6, 6 -> 7 -> 14
+    long expected[] = {2, 6, 14};
+    long expectedReadSum = 0;
+    for (long frame = 0; frame < 3; ++frame) {
+        scheduler.run(ecs);
+        expectedReadSum += (expected[frame] / 2) * 1000;
+        ecs.forEach<Component1, Component2, Component3>(
+            [&](EntityHandle, Component1& c1, Component2& c2, Component3& c3) {
+                REQUIRE(c1.x == expected[frame]);
+                REQUIRE(c2.x == expected[frame] / 2);
+                REQUIRE(c3.z == frame + 1);
+            });
+        REQUIRE(readSum == expectedReadSum);
+    }
+}
+
+TEST_CASE("Chunked systems sharing a container run as a pipeline", "[scheduler]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(1), 1000);
+    for (u32 i = 0; i < 1000; ++i) {
+        const EntityHandle e = ecs.newEntity();
+        ecs.addComponent<Component1>(e) = {long(i)};
+        ecs.addComponent<Component2>(e) = {0, 0};
+    }
+
+    // Without workers the calling thread takes the newest task first
+    SystemScheduler<EntitySystem> scheduler(0);
+    std::vector<u32> order;
+    scheduler.addChunkedSystem<Write<Component1>>([&](EntitySystem& world, u32 chunk) {
+        world.forEachInChunk<Component1>(chunk, [](EntityHandle, Component1& c1) { ++c1.x; });
+        order.push_back(chunk);
+    });
+    scheduler.addChunkedSystem<Read<Component1>, Write<Component2>>(
+        [&](EntitySystem& world, u32 chunk) {
+            world.forEachInChunk<Component1, Component2>(
+                chunk, [](EntityHandle, Component1& c1, Component2& c2) { c2.x = c1.x; });
+            order.push_back(MaxComponentChunks + chunk);
+        });
+    long total = 0;
+    scheduler.addSystem<Read<Component2>>([&](EntitySystem& world) {
+        world.forEach<Component2>([&](EntityHandle, Component2& c2) { total += c2.x; });
+    });
+    REQUIRE(scheduler.dependencies(1) == 1);
+    REQUIRE(scheduler.dependencies(2) == 1);
+
+    scheduler.run(ecs);
+    REQUIRE(order.size() == 2 * MaxComponentChunks);
+    // Each chunk of the second system follows the same chunk of the first
+    for (u32 i = 0; i < order.size(); i += 2) {
+        REQUIRE(order[i] < MaxComponentChunks);
+        REQUIRE(order[i + 1] == MaxComponentChunks + order[i]);
+    }
+    REQUIRE(total == 1000 * 1001 / 2);
+
+    ecs.forEach<Component1, Component2>([](EntityHandle, Component1& c1, Component2& c2) {
+        REQUIRE(c2.x == c1.x);
+    });
+}
+
+TEST_CASE("Access checks report undeclared conflicting accesses", "[scheduler]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(1), 100);
+    for (u32 i = 0; i < 100; ++i) {
+        const EntityHandle e = ecs.newEntity();
+        ecs.addComponent<Component1>(e) = {1};
+        ecs.addComponent<Component2>(e) = {1, 1};
+        ecs.addComponent<Component3>(e) = {1, 1, 1};
+    }
+    auto move = [](EntitySystem& world) {
+        world.forEach<Component1>([](EntityHandle, Component1& c1) { ++c1.x; });
+    };
+    auto push = [](EntitySystem& world) {
+        world.forEach<Component1, Component2>(
+            [](EntityHandle, Component1& c1, Component2& c2) { c1.x += c2.x; });
+    };
+    auto render = [](EntitySystem& world) {
+        world.forEach<Component3>([&](EntityHandle e, Component3& c3) {
+            c3.z = world.getComponent<Component1>(e)->x;
+        });
+    };
+
+    SECTION("Undeclared writes conflict with unordered systems")
+    {
+        SystemScheduler<EntitySystem> scheduler(2);
+        scheduler.addSystem<Write<Component1>>(move, "move");
+        scheduler.addSystem<Read<Component2>>(push, "push");
+        scheduler.addSystem<Read<Component1>, Write<Component3>>(render, "render");
+        scheduler.run(ecs);
+        // push writes Component1 alongside move and render
+        REQUIRE(scheduler.accessConflicts() == 2);
+    }
+
+    SECTION("Declared accesses don't conflict")
+    {
+        SystemScheduler<EntitySystem> scheduler(2);
+        scheduler.addSystem<Write<Component1>>(move, "move");
+        scheduler.addSystem<Write<Component1>, Read<Component2>>(push, "push");
+        scheduler.addSystem<Read<Component1>, Write<Component3>>(render, "render");
+        scheduler.run(ecs);
+        REQUIRE(scheduler.accessConflicts() == 0);
+    }
+}
+
+TEST_CASE("Budgeted pass resumes where it stopped", "[iteration]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(1), 1000);
+    std::vector<EntityHandle> handles;
+    for (u32 i = 0; i < 1000; ++i) {
+        const EntityHandle e = ecs.newEntity();
+        ecs.addComponent<Component1>(e) = {0};
+        if (i % 2 == 0) {
+            ecs.addComponent<Component2>(e) = {0, 0};
+        }
+        handles.push_back(e);
+    }
+
+    IterationCursor cursor;
+    IterationBudget budget;
+    budget.entities = 100;
+    auto visit = [](EntityHandle, Component1& c1, Component2&) { ++c1.x; };
+
+    u32 calls = 1;
+    while (!ecs.forEachBudgeted<Component1, Component2>(cursor, budget, visit)) {
+        // Entities removed mid pass are not visited anymore
+        if (calls == 2) {
+            for (u32 i = 0; i < 1000; i += 10) {
+                ecs.removeEntity(handles[i]);
+            }
+        }
+        ++calls;
+    }
+    // 200 matches before the removal, 240 of the 300 left after it
+    REQUIRE(calls == 5);
+    u32 visited = 0;
+    ecs.forEach<Component1>([&](EntityHandle e, Component1& c1) {
+        const bool matching = ecs.entityHasComponent<Component2>(e);
+        REQUIRE(c1.x == (matching ? 1 : 0));
+        visited += c1.x;
+    });
+    REQUIRE(visited == 400);
+    REQUIRE(cursor.position == 0);
+
+    // A time budget still makes progress on every call
+    budget = {};
+    budget.time = std::chrono::steady_clock::duration::zero();
+    calls = 1;
+    while (!ecs.forEachBudgeted<Component1>(cursor, budget, [](EntityHandle, Component1& c1) {
+        ++c1.x;
+    })) {
+        ++calls;
+    }
+    REQUIRE(calls > 1);
+    ecs.forEach<Component1>([&](EntityHandle e, Component1& c1) {
+        REQUIRE(c1.x == (ecs.entityHasComponent<Component2>(e) ? 2 : 1));
+    });
+}
+
+TEST_CASE("Slices wrap around and reach every entity", "[iteration]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(1), 200);
+    std::vector<EntityHandle> handles;
+    for (u32 i = 0; i < 100; ++i) {
+        const EntityHandle e = ecs.newEntity();
+        ecs.addComponent<Component1>(e) = {0};
+        handles.push_back(e);
+    }
+    IterationCursor cursor;
+    auto visit = [](EntityHandle, Component1& c1) { ++c1.x; };
+
+    for (u32 call = 0; call < 10; ++call) {
+        REQUIRE(ecs.forEachSlice<Component1>(cursor, 30, visit) == 30);
+    }
+    ecs.forEach<Component1>([](EntityHandle, Component1& c1) { REQUIRE(c1.x == 3); });
+
+    // A slice larger than the container visits each entity once
+    REQUIRE(ecs.forEachSlice<Component1>(cursor, 1000, visit) == 100);
+    ecs.forEach<Component1>([](EntityHandle, Component1& c1) { REQUIRE(c1.x == 4); });
+
+    // Removed entries leave holes, new ones fill them or append
+    for (u32 i = 0; i < 100; i += 10) {
+        ecs.removeEntity(handles[i]);
+    }
+    for (u32 i = 0; i < 20; ++i) {
+        ecs.addComponent<Component1>(ecs.newEntity()) = {100};
+    }
+    for (u32 call = 0; call < 8; ++call) {
+        ecs.forEachSlice<Component1>(cursor, 30, visit);
+    }
+    ecs.forEach<Component1>([](EntityHandle, Component1& c1) {
+        REQUIRE(c1.x >= (c1.x >= 100 ? 101 : 5));
+    });
+}
+
+TEST_CASE("Disabled entities are skipped by iteration", "[entity]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(1), 100);
+    std::vector<EntityHandle> handles;
+    for (u32 i = 0; i < 100; ++i) {
+        const EntityHandle e = ecs.newEntity();
+        ecs.addComponent<Component1>(e) = {long(i)};
+        ecs.addComponent<Component2>(e) = {long(i), 0};
+        handles.push_back(e);
+    }
+    for (u32 i = 0; i < 100; i += 4) {
+        ecs.setEntityEnabled(handles[i], false);
+    }
+    REQUIRE(!ecs.isEntityEnabled(handles[0]));
+    REQUIRE(ecs.isEntityEnabled(handles[1]));
+    // Components are still there
+    REQUIRE(ecs.getComponent<Component1>(handles[0])->x == 0);
+
+    const QueryStrategy strategies[] = {QueryStrategy::ProbeJoin,
+                                        QueryStrategy::PrefetchedProbeJoin,
+                                        QueryStrategy::BitsetIntersection,
+                                        QueryStrategy::MergeJoin};
+    for (QueryStrategy strategy : strategies) {
+        u32 visited = 0;
+        ecs.forEach<Component1, Component2>(strategy, [&](EntityHandle e, Component1& c1, Component2&) {
+            REQUIRE(c1.x % 4 != 0);
+            REQUIRE(ecs.isEntityEnabled(e));
+            ++visited;
+        });
+        REQUIRE(visited == 75);
+    }
+    IterationCursor cursor;
+    REQUIRE(ecs.forEachSlice<Component1>(cursor, 1000, [](EntityHandle, Component1&) {}) == 75);
+
+    ecs.setEntityEnabled(handles[4], true);
+    u32 visited = 0;
+    ecs.forEach<Component1>([&](EntityHandle, Component1&) { ++visited; });
+    REQUIRE(visited == 76);
+
+    // A destroyed entity doesn't leave its id disabled
+    ecs.removeEntity(handles[8]);
+    const EntityHandle reused = ecs.newEntity();
+    REQUIRE(reused.id == handles[8].id);
+    REQUIRE(ecs.isEntityEnabled(reused));
+}
+
+TEST_CASE("Prefab instances get copies of the prefab components", "[prefab]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(1), 2000);
+    // A hole in the dense storage, instances are appended after it
+    const EntityHandle first = ecs.newEntity();
+    ecs.addComponent<Component1>(first) = {-1};
+    ecs.addComponent<Component1>(ecs.newEntity()) = {-1};
+    ecs.removeComponent<Component1>(first);
+
+    const Prefab prefab = ecs.definePrefab(Component1{5}, Component2{1, 2});
+    std::vector<EntityHandle> handles(1000);
+    ecs.instantiate(prefab, 1000, handles.data());
+    ecs.instantiate(prefab, 10);
+
+    REQUIRE(ecs.getEntityAmount() == 1012);
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component1>()) == 1011);
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component2>()) == 1010);
+    for (EntityHandle e : handles) {
+        REQUIRE(ecs.getComponent<Component1>(e)->x == 5);
+        REQUIRE(ecs.getComponent<Component2>(e)->y == 2);
+        REQUIRE(!ecs.entityHasComponent<Component3>(e));
+    }
+    u32 visited = 0;
+    ecs.forEach<Component1, Component2>([&](EntityHandle, Component1& c1, Component2& c2) {
+        REQUIRE(c1.x == 5);
+        REQUIRE(c2.x == 1);
+        ++visited;
+    });
+    REQUIRE(visited == 1010);
+
+    // Instances are independent and behave like any entity
+    ecs.getComponent<Component1>(handles[0])->x = 6;
+    REQUIRE(ecs.getComponent<Component1>(handles[1])->x == 5);
+    ecs.removeEntity(handles[1]);
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component1>()) == 1010);
+    ecs.addComponent<Component1>(first) = {7};
+    REQUIRE(ecs.getComponent<Component1>(first)->x == 7);
+}
+
+TEST_CASE("Entities are cloned and moved with their components", "[clone]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(1), 2000);
+    MemoryReadyEcs other(MEGABYTES(1), 2000);
+    std::vector<EntityHandle> originals(600);
+    for (u32 i = 0; i < 600; ++i) {
+        originals[i] = ecs.newEntity();
+        ecs.addComponent<Component1>(originals[i]) = {(int)i};
+        if (i % 2 == 0) {
+            ecs.addComponent<Component2>(originals[i]) = {(int)i, -1};
+        }
+    }
+    ecs.setEntityEnabled(originals[3], false);
+
+    const EntityHandle single = ecs.cloneEntity(originals[0]);
+    REQUIRE(ecs.getComponent<Component1>(single)->x == 0);
+    REQUIRE(ecs.getComponent<Component2>(single)->y == -1);
+
+    std::vector<EntityHandle> copies(600);
+    ecs.cloneEntities(originals.data(), 600, copies.data());
+    REQUIRE(ecs.getEntityAmount() == 1201);
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component1>()) == 1201);
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component2>()) == 601);
+    for (u32 i = 0; i < 600; ++i) {
+        REQUIRE(ecs.getComponent<Component1>(copies[i])->x == (int)i);
+        REQUIRE(ecs.entityHasComponent<Component2>(copies[i]) == (i % 2 == 0));
+    }
+    REQUIRE(!ecs.isEntityEnabled(copies[3]));
+    ecs.getComponent<Component1>(copies[1])->x = 100;
+    REQUIRE(ecs.getComponent<Component1>(originals[1])->x == 1);
+
+    const EntityHandle moved = ecs.moveEntity(single, other);
+    REQUIRE(!ecs.isEntityHandleValid(single));
+    REQUIRE(other.getComponent<Component2>(moved)->y == -1);
+
+    std::vector<EntityHandle> arrived(600);
+    ecs.moveEntities(originals.data(), 600, other, arrived.data());
+    REQUIRE(ecs.getEntityAmount() == 600);
+    REQUIRE(other.getEntityAmount() == 601);
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component1>()) == 600);
+    REQUIRE(other.getComponentAmount(ComponentTypes::TypeId<Component2>()) == 301);
+    u32 visited = 0;
+    other.forEach<Component1, Component2>([&](EntityHandle, Component1& c1, Component2& c2) {
+        REQUIRE(c1.x == c2.x);
+        ++visited;
+    });
+    REQUIRE(visited == 301);
+    REQUIRE(!other.isEntityEnabled(arrived[3]));
+}
+
+TEST_CASE("Merged worlds keep their components", "[merge]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(1), 3000);
+    MemoryReadyEcs section(MEGABYTES(1), 3000);
+    for (u32 i = 0; i < 100; ++i) {
+        ecs.addComponent<Component1>(ecs.newEntity()) = {-1};
+    }
+
+    for (int round = 0; round < 2; ++round) {
+        std::vector<EntityHandle> entities(1000);
+        for (u32 i = 0; i < 1000; ++i) {
+            entities[i] = section.newEntity();
+            section.addComponent<Component1>(entities[i]) = {(int)i};
+        }
+        // Component2 points at another entity of the section
+        for (u32 i = 0; i < 1000; ++i) {
+            section.addComponent<Component2>(entities[i]) = {(int)entities[(i + 999) % 1000].id, (int)i};
+        }
+        section.removeEntity(entities[10]);
+        section.removeComponent<Component1>(entities[20]);
+        section.setEntityEnabled(entities[30], false);
+
+        const std::vector<EntityHandle> remap = ecs.merge(std::move(section));
+        REQUIRE(section.getEntityAmount() == 0);
+        REQUIRE(!remap[entities[10].id].alive);
+        REQUIRE(!ecs.entityHasComponent<Component1>(remap[entities[20].id]));
+        REQUIRE(!ecs.isEntityEnabled(remap[entities[30].id]));
+        for (u32 i = 0; i < 1000; ++i) {
+            if (i == 10) {
+                continue;
+            }
+            const EntityHandle e = remap[entities[i].id];
+            REQUIRE(ecs.getComponent<Component2>(e)->y == (int)i);
+            if (i != 20) {
+                REQUIRE(ecs.getComponent<Component1>(e)->x == (int)i);
+            }
+            // Fix up the reference
+            const u32 previous = (i + 999) % 1000;
+            if (previous != 10) {
+                const EntityHandle target = remap[ecs.getComponent<Component2>(e)->x];
+                REQUIRE(ecs.getComponent<Component2>(target)->y == (int)previous);
+            }
+        }
+    }
+    REQUIRE(ecs.getEntityAmount() == 100 + 2 * 999);
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component1>()) == 100 + 2 * 998);
+    u32 visited = 0;
+    ecs.forEach<Component1, Component2>([&](EntityHandle, Component1& c1, Component2& c2) {
+        REQUIRE(c1.x == c2.y);
+        ++visited;
+    });
+    REQUIRE(visited == 2 * 997);
+}
+
+TEST_CASE("Merging a world collects its pending removals and flattens its regions", "[merge]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(2), 3000);
+    MemoryReadyEcs section(MEGABYTES(2), 3000);
+    const RegionHandle region = section.createRegion(MEGABYTES(1), 100);
+    std::vector<EntityHandle> entities;
+    for (u32 i = 0; i < 200; ++i) {
+        entities.push_back(section.newEntity(i < 100 ? region : 0));
+        section.addComponent<Component1>(entities.back()) = {(int)i};
+    }
+    // Destroyed, but their components wait for a collection
+    REQUIRE(section.destroyEntityConcurrent(entities[5]));
+    REQUIRE(section.destroyEntityConcurrent(entities[150]));
+
+    const std::vector<EntityHandle> remap = ecs.merge(std::move(section));
+    REQUIRE(ecs.getEntityAmount() == 198);
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component1>()) == 198);
+    REQUIRE(!remap[entities[5].id].alive);
+    REQUIRE(!remap[entities[150].id].alive);
+    u32 visited = 0;
+    ecs.forEach<Component1>([&](EntityHandle e, Component1& c1) {
+        REQUIRE(e.id > 0);
+        REQUIRE(remap[entities[c1.x].id].id == e.id);
+        ++visited;
+    });
+    REQUIRE(visited == 198);
+
+    // Region entities merged in are plain entities, the region is gone
+    ecs.removeEntity(remap[entities[0].id]);
+    REQUIRE(ecs.getEntityAmount() == 197);
+    REQUIRE(section.getEntityAmount() == 0);
+    REQUIRE(section.newEntity().id == 1);
+}
+
+TEST_CASE("Unloading a region drops its entities and reuses its memory", "[region]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(4), 20000);
+    const RegionHandle region = ecs.createRegion(MEGABYTES(1), 1000);
+    std::vector<EntityHandle> world;
+    auto load = [&](bool withWorld) {
+        std::vector<EntityHandle> section;
+        for (u32 i = 0; i < 1000; ++i) {
+            section.push_back(ecs.newEntity(region));
+            ecs.addComponent<Component1>(section.back()) = {(int)i};
+            if (i % 2 == 0) {
+                ecs.addComponent<Component2>(section.back()) = {(int)i, 1};
+            }
+            // World entities share the containers with the region ones
+            if (withWorld) {
+                world.push_back(ecs.newEntity());
+                ecs.addComponent<Component1>(world.back()) = {-1};
+            }
+        }
+        ecs.removeComponent<Component1>(section[1]);
+        ecs.removeEntity(section[2]);
+        ecs.setEntityEnabled(section[4], false);
+        // Destroyed ids are reused in the region
+        section[2] = ecs.newEntity(region);
+        return section;
+    };
+
+    const std::vector<EntityHandle> first = load(true);
+    REQUIRE(ecs.getEntityAmount() == 2000);
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component1>()) == 1998);
+    u32 visited = 0;
+    ecs.forEach<Component1, Component2>([&](EntityHandle, Component1& c1, Component2& c2) {
+        REQUIRE(c1.x == c2.x);
+        ++visited;
+    });
+    REQUIRE(visited == 498);
+
+    ecs.unloadRegion(region);
+    const u32 used = ecs.arena().usedSize();
+    REQUIRE(ecs.getEntityAmount() == 1000);
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component1>()) == 1000);
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component2>()) == 0);
+    REQUIRE(!ecs.isEntityHandleValid(first[0]));
+    visited = 0;
+    ecs.forEach<Component1>([&](EntityHandle e, Component1& c1) {
+        REQUIRE(c1.x == -1);
+        REQUIRE(ecs.isEntityHandleValid(e));
+        ++visited;
+    });
+    REQUIRE(visited == 1000);
+
+    // A second load takes the same memory, handles of the first stay invalid
+    const std::vector<EntityHandle> second = load(false);
+    REQUIRE(ecs.arena().usedSize() == used);
+    REQUIRE(!ecs.isEntityHandleValid(first[0]));
+    REQUIRE(second[0].id == first[0].id);
+    REQUIRE(ecs.getComponent<Component1>(second[3])->x == 3);
+    REQUIRE(!ecs.isEntityEnabled(second[4]));
+    visited = 0;
+    ecs.forEach<Component1>([&](EntityHandle, Component1&) { ++visited; });
+    REQUIRE(visited == 1000 + 997);
+    ecs.unloadRegion(region);
+    REQUIRE(ecs.getEntityAmount() == 1000);
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component1>()) == 1000);
+    for (EntityHandle e : world) {
+        REQUIRE(ecs.getComponent<Component1>(e)->x == -1);
+    }
+}
+
+TEST_CASE("Unloading a region collects the entities destroyed concurrently", "[region]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(4), 20000);
+    const RegionHandle region = ecs.createRegion(MEGABYTES(1), 100);
+    const EntityHandle world = ecs.newEntity();
+    ecs.addComponent<Component1>(world) = {-1};
+    std::vector<EntityHandle> loaded;
+    for (int i = 0; i < 10; ++i) {
+        loaded.push_back(ecs.newEntity(region));
+        ecs.addComponent<Component1>(loaded.back()) = {i};
+    }
+    REQUIRE(ecs.destroyEntityConcurrent(loaded[3]));
+    REQUIRE(ecs.destroyEntityConcurrent(world));
+    ecs.unloadRegion(region);
+    REQUIRE(ecs.getEntityAmount() == 0);
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component1>()) == 0);
+
+    // Nothing is left to collect, so no id is handed out twice
+    std::set<u32> ids;
+    for (int i = 0; i < 10; ++i) {
+        ids.insert(ecs.newEntity(region).id);
+    }
+    ecs.collectDestroyedEntities();
+    for (int i = 0; i < 10; ++i) {
+        ids.insert(ecs.newEntity(region).id);
+    }
+    ids.insert(ecs.newEntity().id);
+    REQUIRE(ids.size() == 21);
+    REQUIRE(ecs.getEntityAmount() == 21);
+}
+
+TEST_CASE("Clones skip unchanged chunks moved by sorting after an unload", "[region]")
+{
+    // Chunks of 101 entries
+    MemoryReadyEcs ecs(MEGABYTES(4), 3200);
+    const RegionHandle region = ecs.createRegion(MEGABYTES(1), 100);
+    std::vector<EntityHandle> world;
+    auto addWorld = [&](int count) {
+        for (int i = 0; i < count; ++i) {
+            world.push_back(ecs.newEntity());
+            ecs.addComponent<Component1>(world.back()) = {int(world.size())};
+        }
+    };
+    // The world fills chunk 0, the region takes chunk 1 and the world
+    // grows into chunk 2
+    addWorld(100);
+    ecs.addComponent<Component1>(ecs.newEntity(region)) = {-1};
+    addWorld(50);
+    ecs.unloadRegion(region);
+    // Chunk 1 gets memory above chunk 2
+    REQUIRE(ecs.sortByEntity<Component1>());
+
+    std::unique_ptr<char[]> ringMemory = std::make_unique<char[]>(MEGABYTES(16));
+    SnapshotRing<EntitySystem, 2> ring(ringMemory.get(), MEGABYTES(16));
+    std::unique_ptr<char[]> cloneMemory;
+    EntitySystem clone = copyWorld(ecs, cloneMemory);
+    std::unique_ptr<char[]> expectedMemory;
+    EntitySystem expected = copyWorld(ecs, expectedMemory);
+    for (int frame = 0; frame < 4; ++frame) {
+        ecs.takeChangedChunks();
+        ecs.cloneChangesInto(clone, EntitySystem::ChangedChunks{});
+        ring.save(ecs);
+    }
+    REQUIRE(std::memcmp(clone.arena().memory(), expected.arena().memory(),
+                        expected.arena().usedSize()) == 0);
+    ring.restore(ecs, 1);
+    REQUIRE(std::memcmp(ecs.arena().memory(), expected.arena().memory(),
+                        expected.arena().usedSize()) == 0);
+    for (size_t i = 0; i < world.size(); ++i) {
+        REQUIRE(clone.getComponent<Component1>(world[i])->x == int(i + 1));
+    }
+}
+
+struct Triple {
+    std::int32_t a, b, c;
+};
+REGISTER_COMPONENT_TYPE(ComponentTypes, Triple, 4);
+
+TEST_CASE("Region chunks are aligned and refuse to overflow", "[region]")
+{
+    // Chunks of 101 entries, a chunk of triples is not a multiple of 8 bytes
+    MemoryReadyEcs ecs(MEGABYTES(4), 3200);
+    const RegionHandle region = ecs.createRegion(12288, 100);
+    const EntityHandle e = ecs.newEntity(region);
+    ecs.addComponent<Triple>(e) = {1, 2, 3};
+    ecs.addComponent<Component1>(e) = {7};
+    REQUIRE((std::uintptr_t)ecs.getComponent<Component1>(e) % alignof(std::uint64_t) == 0);
+    REQUIRE(ecs.getComponent<Triple>(e)->c == 3);
+
+    // Each type takes a sparse page, a data chunk and an owners chunk
+    REQUIRE_THROWS(ecs.addComponent<Component3>(e));
+}
+
+TEST_CASE("Handles of unloaded regions stay invalid over many loads", "[region]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(4), 20000);
+    const RegionHandle first = ecs.createRegion(MEGABYTES(1), 100);
+    const EntityHandle world = ecs.newEntity();
+    ecs.addComponent<Component1>(world) = {-1};
+    const RegionHandle second = ecs.createRegion(MEGABYTES(1), 100);
+    const EntityHandle kept = ecs.newEntity(second);
+    ecs.addComponent<Component1>(kept) = {-2};
+
+    std::vector<EntityHandle> stale;
+    for (int i = 0; i < 20; ++i) {
+        const EntityHandle e = ecs.newEntity(first);
+        ecs.addComponent<Component1>(e) = {i};
+        for (EntityHandle old : stale) {
+            REQUIRE(old.id == e.id);
+            REQUIRE(!ecs.isEntityHandleValid(old));
+        }
+        stale.push_back(e);
+        ecs.unloadRegion(first);
+    }
+    REQUIRE(ecs.getEntityAmount() == 2);
+    REQUIRE(ecs.getComponent<Component1>(world)->x == -1);
+    REQUIRE(ecs.getComponent<Component1>(kept)->x == -2);
+
+    // Removals find the region of each entity from its id
+    ecs.removeEntity(kept);
+    REQUIRE(ecs.newEntity(second).id == kept.id);
+    ecs.removeEntity(world);
+    REQUIRE(ecs.newEntity().id == world.id);
+}
+
+TEST_CASE("Containers with region entities are not sorted", "[region]")
+{
+    MemoryReadyEcs ecs(MEGABYTES(4), 20000);
+    const RegionHandle region = ecs.createRegion(MEGABYTES(1), 1000);
+    std::vector<EntityHandle> world;
+    for (int i = 0; i < 1000; ++i) {
+        ecs.addComponent<Component1>(ecs.newEntity(region)) = {i};
+        world.push_back(ecs.newEntity());
+        ecs.addComponent<Component1>(world.back()) = {-i};
+        ecs.addComponent<Component2>(world.back()) = {-i, 0};
+    }
+    auto descending = [](const Component1& a, const Component1& b) { return a.x > b.x; };
+    REQUIRE_FALSE(ecs.sortByEntity<Component1>());
+    REQUIRE_FALSE(ecs.sort<Component1>(descending));
+    // Containers without region chunks still sort
+    REQUIRE(ecs.sort<Component2>([](const Component2& a, const Component2& b) { return a.x > b.x; }));
+
+    ecs.unloadRegion(region);
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component1>()) == 1000);
+    for (int i = 0; i < 1000; ++i) {
+        REQUIRE(ecs.getComponent<Component1>(world[i])->x == -i);
+    }
+
+    // Once unloaded, the dropped chunks take part in sorting
+    REQUIRE(ecs.sort<Component1, Component2>(descending));
+    int previous = 1;
+    u32 visited = 0;
+    ecs.forEach<Component1>([&](EntityHandle e, Component1& c1) {
+        REQUIRE(c1.x < previous);
+        REQUIRE(ecs.getComponent<Component2>(e)->x == c1.x);
+        previous = c1.x;
+        ++visited;
+    });
+    REQUIRE(visited == 1000);
+    REQUIRE(ecs.getComponentAmount(ComponentTypes::TypeId<Component1>()) == 1000);
+}